@@ -0,0 +1,90 @@
+#ifndef BLINN_PHONG_HPP
+#define BLINN_PHONG_HPP
+
+#include "../src/sw.hpp"
+// Blinn-Phong shaders for the software rasterizer, shared by the teapot scene and the replay tool.
+
+// https://en.wikipedia.org/wiki/Blinn%E2%80%93Phong_reflection_model
+inline glm::vec4 blinn_phong_sw_vs(const COL781::Software::Uniforms &uniforms, const COL781::Software::Attribs &in, COL781::Software::Attribs &out)
+{
+
+    glm::vec4 inputPosition = in.get<glm::vec4>(0);
+    glm::vec4 inputNormal = in.get<glm::vec4>(1);
+    // std::cout << inputPosition.x << " " << inputPosition.y << " " << inputPosition.z << std::endl;
+
+    glm::mat4 projection = uniforms.get<glm::mat4>("projection");
+    glm::mat4 modelview = uniforms.get<glm::mat4>("modelview");
+    glm::mat4 normalMat = uniforms.get<glm::mat4>("normalMat");
+
+    glm::vec4 position = projection * modelview * inputPosition;
+    glm::vec4 vertPos4 = modelview * inputPosition;
+    glm::vec3 vertPos = glm::vec3(vertPos4) / vertPos4.w;
+    glm::vec3 normalInterp = glm::normalize(glm::vec3(normalMat * inputNormal));
+    // std::cout << vertPos.x << " " << vertPos.y << " " << vertPos.z << std::endl;
+
+    out.set<glm::vec4>(0, glm::vec4(vertPos, 0));
+    out.set<glm::vec4>(1, inputNormal); // this is an approximation we don't need because
+                                        // we're doing phong shading and not gouraud
+                                        // can normalize the normals just like any other
+
+    return position;
+}
+
+inline glm::vec4 blinn_phong_sw_fs(const COL781::Software::Uniforms &uniforms, const COL781::Software::Attribs &in)
+{
+
+    const glm::vec3 lightPos = uniforms.get<glm::vec3>("lightPos");         // vec3(1.0, 1.0, 1.0);
+    const glm::vec3 lightColor = uniforms.get<glm::vec3>("lightColor");     // vec3(1.0, 1.0, 1.0);
+    const float lightPower = uniforms.get<float>("lightPower");             // 40.0;
+    const glm::vec3 ambientColor = uniforms.get<glm::vec3>("ambientColor"); // vec3(0.1, 0.0, 0.0);
+    const glm::vec3 diffuseColor = uniforms.get<glm::vec3>("diffuseColor"); // vec3(0.5, 0.0, 0.0);
+    const glm::vec3 specColor = uniforms.get<glm::vec3>("specColor");       // vec3(1.0, 1.0, 1.0);
+    const float shininess = uniforms.get<float>("shininess");               // 16.0;
+    const float screenGamma = uniforms.get<float>("screenGamma");           // 2.2;
+
+    glm::vec3 vertPos = glm::vec3(in.get<glm::vec4>(0));
+    glm::vec3 normal = glm::vec3(in.get<glm::vec4>(1));
+
+    // std::cout << vertPos.x << "," << vertPos.y << "," << vertPos.z << std::endl;
+
+    glm::vec3 lightDir = lightPos - vertPos;
+    float distance = glm::length(lightDir);
+    distance = distance * distance;
+    lightDir = glm::normalize(lightDir);
+
+    float lambertian = fmax(glm::dot(lightDir, normal), 0.0);
+    float specular = 0.0;
+
+    if (lambertian > 0.0)
+    {
+
+        glm::vec3 viewDir = glm::normalize(-vertPos);
+
+        // this is blinn phong
+        glm::vec3 halfDir = glm::normalize(lightDir + viewDir);
+        float specAngle = fmax(glm::dot(halfDir, normal), 0.0);
+        specular = pow(specAngle, shininess);
+
+        // this is phong (for comparison)
+        /*
+        if (mode == 2) {
+          vec3 reflectDir = reflect(-lightDir, normal);
+          specAngle = fmax(dot(reflectDir, viewDir), 0.0);
+          // note that the exponent is different here
+          specular = pow(specAngle, shininess/4.0);
+        }
+        */
+    }
+    glm::vec3 colorLinear = ambientColor + diffuseColor * lambertian * lightColor * lightPower / distance +
+                            specColor * specular * lightColor * lightPower / distance;
+    // apply gamma correction (assume ambientColor, diffuseColor and specColor
+    // have been linearized, i.e. have no gamma correction in them)
+    glm::vec3 colorGammaCorrected = glm::pow(colorLinear, glm::vec3(1.0 / screenGamma));
+    colorGammaCorrected.x = fmin(1, fmax(0, colorGammaCorrected.x));
+    colorGammaCorrected.y = fmin(1, fmax(0, colorGammaCorrected.y));
+    colorGammaCorrected.z = fmin(1, fmax(0, colorGammaCorrected.z));
+    // use the gamma corrected color in the fragment
+    return glm::vec4(colorGammaCorrected, 1.0);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "../src/a1.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+// Checks depth precision far from the camera: a red square 20000 units away in front of a blue one
+// 20 units behind it, covering the same pixels. Float32 with a standard projection rounds both to
+// the same depth, so blue shows through; Float32Reversed with Core::reversedPerspective keeps them
+// apart.
+
+namespace R = COL781::Software;
+namespace Core = COL781::Core;
+using namespace glm;
+
+int blue_pixels(R::Rasterizer &r, Core::DepthFormat format, const mat4 &projection)
+{
+    R::ShaderProgram program = r.createShaderProgram(r.vsTransform(), r.fsConstant());
+    vec4 vertices[] = {vec4(-1.0, -1.0, 0.0, 1.0), vec4(1.0, -1.0, 0.0, 1.0), vec4(-1.0, 1.0, 0.0, 1.0),
+                       vec4(1.0, 1.0, 0.0, 1.0)};
+    ivec3 triangles[] = {ivec3(0, 1, 2), ivec3(1, 2, 3)};
+    R::Object square = r.createObject();
+    r.setVertexAttribs(square, 0, 4, vertices);
+    r.setTriangleIndices(square, 2, triangles);
+
+    r.setDepthFormat(format);
+    r.enableDepthTest();
+    r.clear(vec4(1.0, 1.0, 1.0, 1.0));
+    r.useShaderProgram(program);
+    // the near square first, so the far one only shows where the depth test cannot separate them
+    float distances[] = {20000.0f, 20020.0f};
+    vec4 colors[] = {vec4(1.0, 0.0, 0.0, 1.0), vec4(0.0, 0.0, 1.0, 1.0)};
+    for (int i = 0; i < 2; i++)
+    {
+        mat4 model =
+            translate(mat4(1.0f), vec3(0.0f, 0.0f, -distances[i])) * scale(mat4(1.0f), vec3(distances[i] / 5));
+        r.setUniform(program, "transform", projection * model);
+        r.setUniform(program, "color", colors[i]);
+        r.drawObject(square);
+    }
+    r.show();
+    r.deleteShaderProgram(program);
+
+    SDL_Surface *surface = r.getDisplaySurface();
+    int count = 0;
+    for (int i = 0; i < surface->h; i++)
+    {
+        Uint32 *row = (Uint32 *)((Uint8 *)surface->pixels + i * surface->pitch);
+        for (int j = 0; j < surface->w; j++)
+        {
+            Uint8 red, green, blue;
+            SDL_GetRGB(row[j], surface->format, &red, &green, &blue);
+            if (blue > 128 && red < 128)
+                count++;
+        }
+    }
+    return count;
+}
+
+int main()
+{
+    R::Rasterizer r;
+    int width = 320, height = 240;
+    if (!r.initializeHeadless(width, height))
+        return EXIT_FAILURE;
+    float aspect = (float)width / (float)height;
+    int standard = blue_pixels(r, Core::DepthFormat::Float32, perspective(radians(60.0f), aspect, 0.1f, 100000.0f));
+    int reversed =
+        blue_pixels(r, Core::DepthFormat::Float32Reversed, Core::reversedPerspective(radians(60.0f), aspect, 0.1f));
+    std::cout << "far square visible through the near one: " << standard << " px with float32, " << reversed
+              << " px with reversed" << std::endl;
+    return standard > 0 && reversed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,115 @@
+#include "../src/a1.hpp"
+#include "../src/capture.hpp"
+#include "blinn_phong.hpp"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+// Replays a capture headlessly and reports frame timings and depth buffer traffic, e.g.
+//     COL781_CAPTURE=teapot.cap COL781_CAPTURE_FRAMES=1 ./teapot
+//     ./replay teapot.cap 20
+//     ./replay teapot.cap 20 float32,reversed,unorm16
+
+namespace R = COL781::Software;
+
+Uint64 checksum(SDL_Surface *surface)
+{
+    // FNV-1a over the visible pixels, to catch changes in the rendered image
+    Uint64 hash = 14695981039346656037ull;
+    for (int i = 0; i < surface->h; i++)
+    {
+        Uint32 *row = (Uint32 *)((Uint8 *)surface->pixels + i * surface->pitch);
+        for (int j = 0; j < surface->w; j++)
+        {
+            hash = (hash ^ row[j]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+const char *const depth_format_names[] = {"float32", "reversed", "unorm16"};
+const COL781::Core::DepthFormat depth_formats[] = {COL781::Core::DepthFormat::Float32,
+                                                   COL781::Core::DepthFormat::Float32Reversed,
+                                                   COL781::Core::DepthFormat::Unorm16};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: " << argv[0] << " <capture> [iterations] [depth formats]" << std::endl;
+        std::cout << "depth formats are a comma-separated list of float32 (the default), reversed and unorm16;"
+                  << " reversed only draws correctly if the capture used a reversed-Z projection" << std::endl;
+        return EXIT_FAILURE;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    std::vector<int> formats;
+    std::stringstream names(argc > 3 ? argv[3] : "float32");
+    std::string name;
+    while (std::getline(names, name, ','))
+    {
+        int f = std::find(depth_format_names, depth_format_names + 3, name) - depth_format_names;
+        if (f == 3)
+        {
+            std::cout << "unknown depth format " << name << std::endl;
+            return EXIT_FAILURE;
+        }
+        formats.push_back(f);
+    }
+
+    R::Rasterizer r;
+    r.registerShader("blinn_phong_sw_vs", blinn_phong_sw_vs);
+    r.registerShader("blinn_phong_sw_fs", blinn_phong_sw_fs);
+
+    R::Replay replay;
+    if (!replay.load(argv[1]))
+        return EXIT_FAILURE;
+    if (!r.initializeHeadless(replay.width, replay.height, replay.spp))
+        return EXIT_FAILURE;
+    std::cout << "Replaying " << replay.frames << " frame(s) at " << replay.width << "x" << replay.height << ", "
+              << replay.spp << " spp" << std::endl;
+
+    for (int f : formats)
+    {
+        r.setDepthFormat(depth_formats[f]);
+        std::cout << "depth format " << depth_format_names[f] << std::endl;
+        std::vector<double> frame_us;
+        std::vector<R::DepthStats> traffic; // per iteration
+        for (int i = 0; i < iterations; i++)
+        {
+            R::DepthStats before = r.getDepthStats();
+            std::vector<double> times = replay.run(r);
+            double total = 0;
+            for (double t : times)
+                total += t;
+            std::cout << "iteration " << i << ": " << total << " us" << std::endl;
+            frame_us.insert(frame_us.end(), times.begin(), times.end());
+            const R::DepthStats &after = r.getDepthStats();
+            R::DepthStats delta;
+            delta.tests = after.tests - before.tests;
+            delta.bytes_read = after.bytes_read - before.bytes_read;
+            delta.bytes_written = after.bytes_written - before.bytes_written;
+            traffic.push_back(delta);
+        }
+        if (frame_us.empty())
+            continue;
+
+        std::sort(frame_us.begin(), frame_us.end());
+        std::cout << "frame time (us): min " << frame_us.front() << ", median " << frame_us[frame_us.size() / 2]
+                  << ", max " << frame_us.back() << std::endl;
+        // the median iteration, leaving out one-offs like the full depth clear after the tile size changes
+        std::sort(traffic.begin(), traffic.end(), [](const R::DepthStats &a, const R::DepthStats &b) {
+            return a.bytes_read + a.bytes_written < b.bytes_read + b.bytes_written;
+        });
+        const R::DepthStats &depth = traffic[traffic.size() / 2];
+        double frames = replay.frames;
+        std::cout << "depth traffic per frame: " << depth.bytes_read / frames / 1024 << " KiB read, "
+                  << depth.bytes_written / frames / 1024 << " KiB written (" << depth.tests / frames << " tests)"
+                  << std::endl;
+        std::cout << "image checksum: " << std::hex << checksum(r.getDisplaySurface()) << std::dec << std::endl;
+    }
+    const COL781::Core::TilingStats &tiling = r.getTilingStats();
+    std::cout << "tile size: " << tiling.tile_size << " (" << (tiling.adaptive ? "adaptive" : "fixed") << ", "
+              << tiling.retunes << " retunes, mean triangle " << tiling.mean_area << " px)" << std::endl;
+    return EXIT_SUCCESS;
+}
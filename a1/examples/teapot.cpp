@@ -4,6 +4,7 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include "blinn_phong.hpp"
 // Interesting scene - Load a .obj and render it with lighting for now.
 
 namespace R = COL781::Software;
@@ -12,89 +13,6 @@ namespace R = COL781::Software;
 using namespace std::chrono;
 using namespace glm;
 
-// https://en.wikipedia.org/wiki/Blinn%E2%80%93Phong_reflection_model
-glm::vec4 blinn_phong_sw_vs(const R::Uniforms &uniforms, const R::Attribs &in, R::Attribs &out)
-{
-
-    vec4 inputPosition = in.get<vec4>(0);
-    vec4 inputNormal = in.get<vec4>(1);
-    // std::cout << inputPosition.x << " " << inputPosition.y << " " << inputPosition.z << std::endl;
-
-    mat4 projection = uniforms.get<mat4>("projection");
-    mat4 modelview = uniforms.get<mat4>("modelview");
-    mat4 normalMat = uniforms.get<mat4>("normalMat");
-
-    vec4 position = projection * modelview * inputPosition;
-    vec4 vertPos4 = modelview * inputPosition;
-    vec3 vertPos = vec3(vertPos4) / vertPos4.w;
-    vec3 normalInterp = normalize(vec3(normalMat * inputNormal));
-    // std::cout << vertPos.x << " " << vertPos.y << " " << vertPos.z << std::endl;
-
-    out.set<vec4>(0, vec4(vertPos, 0));
-    out.set<vec4>(1, inputNormal); // this is an approximation we don't need because
-                                   // we're doing phong shading and not gouraud
-                                   // can normalize the normals just like any other
-
-    return position;
-}
-
-glm::vec4 blinn_phong_sw_fs(const R::Uniforms &uniforms, const R::Attribs &in)
-{
-
-    const vec3 lightPos = uniforms.get<vec3>("lightPos");         // vec3(1.0, 1.0, 1.0);
-    const vec3 lightColor = uniforms.get<vec3>("lightColor");     // vec3(1.0, 1.0, 1.0);
-    const float lightPower = uniforms.get<float>("lightPower");   // 40.0;
-    const vec3 ambientColor = uniforms.get<vec3>("ambientColor"); // vec3(0.1, 0.0, 0.0);
-    const vec3 diffuseColor = uniforms.get<vec3>("diffuseColor"); // vec3(0.5, 0.0, 0.0);
-    const vec3 specColor = uniforms.get<vec3>("specColor");       // vec3(1.0, 1.0, 1.0);
-    const float shininess = uniforms.get<float>("shininess");     // 16.0;
-    const float screenGamma = uniforms.get<float>("screenGamma"); // 2.2;
-
-    vec3 vertPos = vec3(in.get<vec4>(0));
-    vec3 normal = vec3(in.get<vec4>(1));
-
-    // std::cout << vertPos.x << "," << vertPos.y << "," << vertPos.z << std::endl;
-
-    vec3 lightDir = lightPos - vertPos;
-    float distance = length(lightDir);
-    distance = distance * distance;
-    lightDir = normalize(lightDir);
-
-    float lambertian = fmax(dot(lightDir, normal), 0.0);
-    float specular = 0.0;
-
-    if (lambertian > 0.0)
-    {
-
-        vec3 viewDir = normalize(-vertPos);
-
-        // this is blinn phong
-        vec3 halfDir = normalize(lightDir + viewDir);
-        float specAngle = fmax(dot(halfDir, normal), 0.0);
-        specular = pow(specAngle, shininess);
-
-        // this is phong (for comparison)
-        /*
-        if (mode == 2) {
-          vec3 reflectDir = reflect(-lightDir, normal);
-          specAngle = fmax(dot(reflectDir, viewDir), 0.0);
-          // note that the exponent is different here
-          specular = pow(specAngle, shininess/4.0);
-        }
-        */
-    }
-    vec3 colorLinear = ambientColor + diffuseColor * lambertian * lightColor * lightPower / distance +
-                       specColor * specular * lightColor * lightPower / distance;
-    // apply gamma correction (assume ambientColor, diffuseColor and specColor
-    // have been linearized, i.e. have no gamma correction in them)
-    vec3 colorGammaCorrected = pow(colorLinear, vec3(1.0 / screenGamma));
-    colorGammaCorrected.x = fmin(1, fmax(0, colorGammaCorrected.x));
-    colorGammaCorrected.y = fmin(1, fmax(0, colorGammaCorrected.y));
-    colorGammaCorrected.z = fmin(1, fmax(0, colorGammaCorrected.z));
-    // use the gamma corrected color in the fragment
-    return vec4(colorGammaCorrected, 1.0);
-}
-
 bool load_object(std::string filename, std::vector<vec4> &verts, std::vector<vec4> &normals, std::vector<ivec3> &tris)
 {
 
@@ -158,6 +76,9 @@ int main(int argc, char **argv)
     if (!r.initialize("Teapot", width, height, 4))
         return EXIT_FAILURE;
 
+    // named so that captures of this scene (COL781_CAPTURE=...) can be replayed
+    r.registerShader("blinn_phong_sw_vs", blinn_phong_sw_vs);
+    r.registerShader("blinn_phong_sw_fs", blinn_phong_sw_fs);
     R::ShaderProgram program = r.createShaderProgram(blinn_phong_sw_vs, blinn_phong_sw_fs);
 
     r.setUniform(program, "lightPos", vec3(0, 10.0, 0));
@@ -0,0 +1,65 @@
+#include "../src/a1.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <thread>
+#include <vector>
+// Records the draws of each quadrant on its own thread and submits them together.
+
+namespace R = COL781::Software;
+using namespace glm;
+
+int main()
+{
+    R::Rasterizer r;
+    if (!r.initialize("Command buffers", 640, 480))
+        return EXIT_FAILURE;
+    R::ShaderProgram program = r.createShaderProgram(r.vsTransform(), r.fsConstant());
+    vec4 vertices[] = {
+        vec4(-0.5, -0.5, 0.0, 1.0),
+        vec4(0.25, 0.35, 0.2, 1.0),
+        vec4(-0.25, 0.5, 0.0, 1.0),
+    };
+    ivec3 triangles[] = {ivec3(0, 1, 2)};
+
+    R::Object box = r.createObject();
+    r.setVertexAttribs(box, 0, 3, vertices);
+    r.setTriangleIndices(box, 1, triangles);
+
+    const int n_threads = 4;
+    std::vector<R::CommandBuffer> buffers(n_threads);
+    vec4 colors[] = {vec4(0.9, 0.6, 0.3, 1.0), vec4(0.8, 0.8, 0.8, 1.0), vec4(0.5, 0.5, 0.8, 1.0)};
+
+    float angle = 0;
+    while (!r.shouldQuit())
+    {
+        r.clear(vec4(1.0, 1.0, 1.0, 1.0));
+        angle += 1.0f;
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++)
+        {
+            threads.emplace_back([&, t] {
+                R::CommandBuffer &cb = buffers[t];
+                cb.reset();
+                cb.useShaderProgram(program);
+                mat4 quadrant = translate(mat4(1.0f), vec3(t % 2 ? 0.5f : -0.5f, t / 2 ? 0.5f : -0.5f, 0.0f));
+                quadrant = scale(quadrant, vec3(0.5f));
+                for (int i = 0; i < 3; i++)
+                {
+                    mat4 mvp = rotate(quadrant, radians(angle * (t + 1) + 120.0f * i), vec3(0.0f, 0.0f, 1.0f));
+                    cb.setUniform(program, "transform", mvp);
+                    cb.setUniform(program, "color", colors[i]);
+                    cb.drawObject(box);
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        r.submit(buffers);
+        r.show();
+    }
+    r.deleteShaderProgram(program);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,645 @@
+#include "capture.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+
+namespace COL781
+{
+namespace Software
+{
+
+    const char capture_magic[8] = {'C', 'O', 'L', '7', '8', '1', 'C', 'P'};
+    const uint32_t capture_version = 1;
+
+    int newCaptureId()
+    {
+        static std::atomic<int> next_id(0);
+        return next_id++;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    /// Shader names
+    ////////////////////////////////////////////////////////////////////////////
+
+    struct ShaderRegistry
+    {
+        std::map<std::string, VertexShader> vs;
+        std::map<std::string, FragmentShader> fs;
+    };
+
+    // Shared by all rasterizers, starting with the built-in shaders.
+    ShaderRegistry &shaderRegistry()
+    {
+        static ShaderRegistry registry;
+        if (registry.vs.empty())
+            Rasterizer::builtinShaders(registry.vs, registry.fs);
+        return registry;
+    }
+
+    template <typename Shader> std::string shaderName(const std::map<std::string, Shader> &names, Shader shader)
+    {
+        for (const auto &entry : names)
+        {
+            if (entry.second == shader)
+                return entry.first;
+        }
+        std::cout << "Warning: capturing an unregistered shader, the capture won't replay. "
+                  << "Name it with Rasterizer::registerShader." << std::endl;
+        return "";
+    }
+
+    void Rasterizer::registerShader(const std::string &name, VertexShader vs)
+    {
+        shaderRegistry().vs[name] = vs;
+    }
+
+    void Rasterizer::registerShader(const std::string &name, FragmentShader fs)
+    {
+        shaderRegistry().fs[name] = fs;
+    }
+
+    bool Rasterizer::beginCapture(const std::string &path)
+    {
+        endCapture();
+        capture = new Capture(*this, path);
+        if (!capture->ok())
+        {
+            std::cout << "Could not open capture file " << path << std::endl;
+            endCapture();
+            return false;
+        }
+        return true;
+    }
+
+    void Rasterizer::endCapture()
+    {
+        delete capture;
+        capture = nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    /// Capture
+    ////////////////////////////////////////////////////////////////////////////
+
+    Capture::Capture(Rasterizer &r, const std::string &path) : r(r), out(path, std::ios::binary)
+    {
+        int mult = sqrt(r.spp);
+        out.write(capture_magic, sizeof(capture_magic));
+        write(capture_version);
+        write<int32_t>(r.framebuffer->w / mult);
+        write<int32_t>(r.framebuffer->h / mult);
+        write<int32_t>(r.spp);
+
+        // state set before the capture started
+        if (r.depth_enabled)
+            enableDepthTest();
+        if (r.shader_program != nullptr)
+            useShaderProgram(*r.shader_program);
+    }
+
+    bool Capture::ok() const
+    {
+        return out.good();
+    }
+
+    int Capture::frames() const
+    {
+        return n_frames;
+    }
+
+    void Capture::op(CaptureOp op)
+    {
+        write<uint8_t>((uint8_t)op);
+    }
+
+    template <typename T> void Capture::write(const T &value)
+    {
+        out.write((const char *)&value, sizeof(T));
+    }
+
+    void Capture::write(const std::string &str)
+    {
+        write<uint32_t>(str.size());
+        out.write(str.data(), str.size());
+    }
+
+    void Capture::writeBytes(const void *data, size_t size)
+    {
+        write<uint32_t>(size);
+        out.write((const char *)data, size);
+    }
+
+    void Capture::writeUniforms(const Uniforms &uniforms)
+    {
+        std::vector<std::string> names = uniforms.names();
+        write<uint32_t>(names.size());
+        for (const std::string &name : names)
+        {
+            size_t size;
+            const void *data = uniforms.getRaw(name, size);
+            write(name);
+            writeBytes(data, size);
+        }
+    }
+
+    bool Capture::defineProgram(const ShaderProgram &program, int &id)
+    {
+        auto it = programs.find(program.capture_id);
+        if (it != programs.end())
+        {
+            id = it->second;
+            return false;
+        }
+        id = programs[program.capture_id] = next_id++;
+        ShaderRegistry &registry = shaderRegistry();
+        op(CaptureOp::DefineProgram);
+        write<int32_t>(id);
+        write(shaderName(registry.vs, program.vs));
+        write(shaderName(registry.fs, program.fs));
+        writeUniforms(program.uniforms);
+        return true;
+    }
+
+    bool Capture::defineObject(const Object &object, int &id)
+    {
+        auto it = objects.find(object.capture_id);
+        if (it != objects.end())
+        {
+            id = it->second;
+            return false;
+        }
+        id = objects[object.capture_id] = next_id++;
+        op(CaptureOp::DefineObject);
+        write<int32_t>(id);
+        for (int i = 0; i < object.attributeValues.size(); i++)
+        {
+            int dim = object.attributeDims[i];
+            if (dim == 0)
+                continue;
+            op(CaptureOp::SetVertexAttribs);
+            write<int32_t>(id);
+            write<int32_t>(i);
+            write<int32_t>(object.attributeValues[i].size() / dim);
+            write<int32_t>(dim);
+            writeBytes(object.attributeValues[i].data(), object.attributeValues[i].size() * sizeof(float));
+        }
+        if (!object.indices.empty())
+        {
+            op(CaptureOp::SetTriangleIndices);
+            write<int32_t>(id);
+            write<int32_t>(object.indices.size());
+            writeBytes(object.indices.data(), object.indices.size() * sizeof(glm::ivec3));
+        }
+        return true;
+    }
+
+    void Capture::useShaderProgram(const ShaderProgram &program)
+    {
+        int id;
+        defineProgram(program, id);
+        op(CaptureOp::UseProgram);
+        write<int32_t>(id);
+    }
+
+    void Capture::deleteShaderProgram(const ShaderProgram &program)
+    {
+        auto it = programs.find(program.capture_id);
+        if (it == programs.end())
+            return;
+        op(CaptureOp::DeleteProgram);
+        write<int32_t>(it->second);
+        programs.erase(it);
+    }
+
+    void Capture::setUniform(const ShaderProgram &program, const std::string &name)
+    {
+        int id;
+        if (defineProgram(program, id))
+            return;
+        size_t size;
+        const void *data = program.uniforms.getRaw(name, size);
+        op(CaptureOp::SetUniform);
+        write<int32_t>(id);
+        write(name);
+        writeBytes(data, size);
+    }
+
+    void Capture::setVertexAttribs(const Object &object, int attribIndex, int n, int dim, const float *data)
+    {
+        int id;
+        if (defineObject(object, id))
+            return;
+        op(CaptureOp::SetVertexAttribs);
+        write<int32_t>(id);
+        write<int32_t>(attribIndex);
+        write<int32_t>(n);
+        write<int32_t>(dim);
+        writeBytes(data, n * dim * sizeof(float));
+    }
+
+    void Capture::setTriangleIndices(const Object &object, int n, const glm::ivec3 *indices)
+    {
+        int id;
+        if (defineObject(object, id))
+            return;
+        op(CaptureOp::SetTriangleIndices);
+        write<int32_t>(id);
+        write<int32_t>(n);
+        writeBytes(indices, n * sizeof(glm::ivec3));
+    }
+
+    void Capture::enableDepthTest()
+    {
+        op(CaptureOp::EnableDepthTest);
+    }
+
+    void Capture::clear(glm::vec4 color)
+    {
+        op(CaptureOp::Clear);
+        write(color);
+    }
+
+    void Capture::drawObject(const Object &object)
+    {
+        int id;
+        defineObject(object, id);
+        op(CaptureOp::DrawObject);
+        write<int32_t>(id);
+    }
+
+    void Capture::drawProxy(const Object &object)
+    {
+        int id;
+        defineObject(object, id);
+        op(CaptureOp::DrawProxy);
+        write<int32_t>(id);
+    }
+
+    void Capture::submit(const std::vector<const DrawCall *> &draws)
+    {
+        std::vector<glm::ivec2> ids(draws.size());
+        for (int i = 0; i < draws.size(); i++)
+        {
+            defineProgram(*draws[i]->program, ids[i].x);
+            defineObject(*draws[i]->object, ids[i].y);
+        }
+        op(CaptureOp::Submit);
+        write<int32_t>(draws.size());
+        for (int i = 0; i < draws.size(); i++)
+        {
+            write<int32_t>(ids[i].x);
+            write<int32_t>(ids[i].y);
+            writeUniforms(draws[i]->uniforms);
+        }
+    }
+
+    void Capture::show()
+    {
+        op(CaptureOp::Show);
+        out.flush();
+        n_frames++;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    /// Replay
+    ////////////////////////////////////////////////////////////////////////////
+
+    // What an object holds so far in a capture being loaded, to check that the
+    // rasterizer can draw it: indices within the vertices of attribute 0, and
+    // every other attribute at least as long.
+    struct CapturedObject
+    {
+        std::vector<size_t> floats; // per attribute, appended to like setVertexAttribs does
+        std::vector<int> dims;
+        int lo, hi; // of the triangle indices, hi < lo if there are none
+
+        CapturedObject() : lo(INT_MAX), hi(INT_MIN)
+        {
+        }
+
+        bool drawable() const
+        {
+            if (dims.empty() || dims[0] == 0)
+                return false;
+            size_t n = floats[0] / dims[0];
+            for (size_t i = 1; i < dims.size(); i++)
+            {
+                if (dims[i] != 0 && floats[i] / dims[i] < n)
+                    return false;
+            }
+            return hi < lo || (lo >= 0 && size_t(hi) < n);
+        }
+    };
+
+    // Bounds-checked reads over the loaded file.
+    struct CaptureReader
+    {
+        const char *data;
+        size_t size, pos;
+        bool ok;
+
+        template <typename T> T read()
+        {
+            T value{};
+            if (pos + sizeof(T) > size)
+            {
+                ok = false;
+                return value;
+            }
+            memcpy(&value, data + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        const char *readBytes(size_t &n)
+        {
+            n = read<uint32_t>();
+            if (!ok || pos + n > size)
+            {
+                ok = false;
+                n = 0;
+                return data;
+            }
+            const char *bytes = data + pos;
+            pos += n;
+            return bytes;
+        }
+
+        std::string readString()
+        {
+            size_t n;
+            const char *bytes = readBytes(n);
+            return std::string(bytes, n);
+        }
+
+        Uniforms readUniforms()
+        {
+            Uniforms uniforms;
+            uint32_t count = read<uint32_t>();
+            for (uint32_t i = 0; ok && i < count; i++)
+            {
+                std::string name = readString();
+                size_t n;
+                const char *bytes = readBytes(n);
+                uniforms.setRaw(name, bytes, n);
+            }
+            return uniforms;
+        }
+    };
+
+    bool Replay::load(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open())
+        {
+            std::cerr << "Unable to open capture: " << path << '\n';
+            return false;
+        }
+        std::vector<char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        CaptureReader reader{file.data(), file.size(), 0, true};
+
+        char magic[sizeof(capture_magic)];
+        for (char &c : magic)
+            c = reader.read<char>();
+        if (!reader.ok || memcmp(magic, capture_magic, sizeof(magic)) != 0 ||
+            reader.read<uint32_t>() != capture_version)
+        {
+            std::cerr << path << " is not a capture file (or is from a different version)\n";
+            return false;
+        }
+        width = reader.read<int32_t>();
+        height = reader.read<int32_t>();
+        spp = reader.read<int32_t>();
+
+        records.clear();
+        frames = 0;
+        // the ids defined so far, which every later record must refer to
+        std::set<int> programs;
+        std::map<int, CapturedObject> objects;
+        while (reader.ok && reader.pos < reader.size)
+        {
+            Record rec;
+            rec.op = (CaptureOp)reader.read<uint8_t>();
+            size_t n;
+            const char *bytes;
+            switch (rec.op)
+            {
+            case CaptureOp::DefineProgram:
+                rec.id = reader.read<int32_t>();
+                rec.vs = reader.readString();
+                rec.fs = reader.readString();
+                rec.uniforms = reader.readUniforms();
+                programs.insert(rec.id);
+                break;
+            case CaptureOp::DeleteProgram:
+                rec.id = reader.read<int32_t>();
+                reader.ok &= programs.erase(rec.id) == 1;
+                break;
+            case CaptureOp::UseProgram:
+                rec.id = reader.read<int32_t>();
+                reader.ok &= programs.count(rec.id) == 1;
+                break;
+            case CaptureOp::DefineObject:
+                rec.id = reader.read<int32_t>();
+                objects[rec.id] = CapturedObject();
+                break;
+            case CaptureOp::DrawObject:
+            case CaptureOp::DrawProxy:
+                rec.id = reader.read<int32_t>();
+                reader.ok &= objects.count(rec.id) == 1 && objects[rec.id].drawable();
+                break;
+            case CaptureOp::SetUniform:
+                rec.id = reader.read<int32_t>();
+                rec.name = reader.readString();
+                bytes = reader.readBytes(n);
+                rec.bytes.assign(bytes, bytes + n);
+                reader.ok &= programs.count(rec.id) == 1;
+                break;
+            case CaptureOp::SetVertexAttribs:
+                rec.id = reader.read<int32_t>();
+                rec.a = reader.read<int32_t>();
+                rec.b = reader.read<int32_t>();
+                rec.c = reader.read<int32_t>();
+                bytes = reader.readBytes(n);
+                rec.floats.resize(n / sizeof(float));
+                memcpy(rec.floats.data(), bytes, rec.floats.size() * sizeof(float));
+                reader.ok &= (objects.count(rec.id) == 1 && rec.a >= 0 && rec.c >= 1 && rec.c <= 4 &&
+                              rec.floats.size() == size_t(rec.b) * rec.c);
+                if (reader.ok)
+                {
+                    CapturedObject &object = objects[rec.id];
+                    if (object.dims.size() <= size_t(rec.a))
+                    {
+                        object.floats.resize(rec.a + 1, 0);
+                        object.dims.resize(rec.a + 1, 0);
+                    }
+                    object.floats[rec.a] += rec.floats.size();
+                    object.dims[rec.a] = rec.c;
+                }
+                break;
+            case CaptureOp::SetTriangleIndices:
+                rec.id = reader.read<int32_t>();
+                rec.a = reader.read<int32_t>();
+                bytes = reader.readBytes(n);
+                rec.indices.resize(n / sizeof(glm::ivec3));
+                memcpy((void *)rec.indices.data(), bytes, rec.indices.size() * sizeof(glm::ivec3));
+                reader.ok &= (objects.count(rec.id) == 1 && rec.indices.size() == size_t(rec.a));
+                if (reader.ok)
+                {
+                    CapturedObject &object = objects[rec.id];
+                    object.lo = INT_MAX;
+                    object.hi = INT_MIN;
+                    for (const glm::ivec3 &tri : rec.indices)
+                    {
+                        for (int k = 0; k < 3; k++)
+                        {
+                            object.lo = std::min(object.lo, tri[k]);
+                            object.hi = std::max(object.hi, tri[k]);
+                        }
+                    }
+                }
+                break;
+            case CaptureOp::EnableDepthTest:
+                break;
+            case CaptureOp::Clear:
+                rec.color = reader.read<glm::vec4>();
+                break;
+            case CaptureOp::Submit:
+                rec.a = reader.read<int32_t>();
+                for (int i = 0; reader.ok && i < rec.a; i++)
+                {
+                    SubmitDraw draw;
+                    draw.program = reader.read<int32_t>();
+                    draw.object = reader.read<int32_t>();
+                    draw.uniforms = reader.readUniforms();
+                    reader.ok &= programs.count(draw.program) == 1 && objects.count(draw.object) == 1 &&
+                                 objects[draw.object].drawable();
+                    rec.draws.push_back(draw);
+                }
+                break;
+            case CaptureOp::Show:
+                frames++;
+                break;
+            default:
+                reader.ok = false;
+            }
+            if (reader.ok)
+                records.push_back(std::move(rec));
+        }
+        if (!reader.ok)
+        {
+            std::cerr << "Capture " << path << " is truncated or corrupt, replaying the first " << records.size()
+                      << " calls\n";
+        }
+
+        // fail early rather than halfway through a replay
+        ShaderRegistry &registry = shaderRegistry();
+        for (const Record &rec : records)
+        {
+            if (rec.op != CaptureOp::DefineProgram)
+                continue;
+            if (registry.vs.find(rec.vs) == registry.vs.end() || registry.fs.find(rec.fs) == registry.fs.end())
+            {
+                std::cerr << "Capture uses shaders '" << rec.vs << "', '" << rec.fs
+                          << "'; register them with Rasterizer::registerShader before replaying\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<double> Replay::run(Rasterizer &r)
+    {
+        using namespace std::chrono;
+
+        ShaderRegistry &registry = shaderRegistry();
+        std::map<int, std::unique_ptr<ShaderProgram>> programs;
+        std::map<int, std::unique_ptr<Object>> objects;
+        std::vector<double> frame_us;
+
+        auto tic = high_resolution_clock::now();
+        for (const Record &rec : records)
+        {
+            switch (rec.op)
+            {
+            case CaptureOp::DefineProgram:
+                programs[rec.id].reset(
+                    new ShaderProgram(r.createShaderProgram(registry.vs.at(rec.vs), registry.fs.at(rec.fs))));
+                programs[rec.id]->uniforms = rec.uniforms;
+                break;
+            case CaptureOp::DeleteProgram:
+                r.deleteShaderProgram(*programs.at(rec.id));
+                break;
+            case CaptureOp::UseProgram:
+                r.useShaderProgram(*programs.at(rec.id));
+                break;
+            case CaptureOp::SetUniform:
+                programs.at(rec.id)->uniforms.setRaw(rec.name, rec.bytes.data(), rec.bytes.size());
+                break;
+            case CaptureOp::DefineObject:
+                objects[rec.id].reset(new Object(r.createObject()));
+                break;
+            case CaptureOp::SetVertexAttribs: {
+                Object &object = *objects.at(rec.id);
+                const float *data = rec.floats.data();
+                // clang-format off
+                switch (rec.c)
+                {
+                case 1: r.setVertexAttribs(object, rec.a, rec.b, data); break;
+                case 2: r.setVertexAttribs(object, rec.a, rec.b, (const glm::vec2 *)data); break;
+                case 3: r.setVertexAttribs(object, rec.a, rec.b, (const glm::vec3 *)data); break;
+                case 4: r.setVertexAttribs(object, rec.a, rec.b, (const glm::vec4 *)data); break;
+                }
+                // clang-format on
+                break;
+            }
+            case CaptureOp::SetTriangleIndices:
+                r.setTriangleIndices(*objects.at(rec.id), rec.a, (glm::ivec3 *)rec.indices.data());
+                break;
+            case CaptureOp::EnableDepthTest:
+                r.enableDepthTest();
+                break;
+            case CaptureOp::Clear:
+                r.clear(rec.color);
+                break;
+            case CaptureOp::DrawObject:
+                r.drawObject(*objects.at(rec.id));
+                break;
+            case CaptureOp::DrawProxy:
+                r.drawProxy(*objects.at(rec.id));
+                break;
+            case CaptureOp::Submit: {
+                CommandBuffer buffer;
+                for (const SubmitDraw &draw : rec.draws)
+                {
+                    buffer.draws.push_back(
+                        {programs.at(draw.program).get(), draw.uniforms, objects.at(draw.object).get(), false});
+                }
+                r.submit(buffer);
+                break;
+            }
+            case CaptureOp::Show: {
+                r.show();
+                auto toc = high_resolution_clock::now();
+                frame_us.push_back(duration_cast<nanoseconds>(toc - tic).count() * 1e-3);
+                tic = toc;
+                break;
+            }
+            }
+        }
+        for (auto &entry : programs)
+        {
+            r.deleteShaderProgram(*entry.second);
+        }
+        return frame_us;
+    }
+
+} // namespace Software
+} // namespace COL781
@@ -0,0 +1,125 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "sw.hpp"
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace COL781
+{
+namespace Software
+{
+
+    /* A capture file is a header (magic, version, window size and spp)
+       followed by a stream of records, each an opcode byte and its operands.
+       Programs and objects are referred to by ids handed out the first time
+       they show up in a call; their complete state (shaders, uniforms,
+       attributes, indices) is written out at that point, so a capture can be
+       started at any time and still be replayed on its own. They are told
+       apart by their capture_id, not their address, so one created where
+       another went out of scope is still a new program or object. */
+
+    enum class CaptureOp : uint8_t
+    {
+        DefineProgram,      // id, vs name, fs name, uniforms
+        DeleteProgram,      // id
+        UseProgram,         // id
+        SetUniform,         // id, name, bytes
+        DefineObject,       // id
+        SetVertexAttribs,   // id, attribIndex, n, dim, floats
+        SetTriangleIndices, // id, n, indices
+        EnableDepthTest,    //
+        Clear,              // color
+        DrawObject,         // id
+        Submit,             // count, (program id, object id, uniforms) per draw
+        Show,               //
+        DrawProxy,          // id
+    };
+    // Occlusion queries aren't recorded: their results already shaped the calls that follow them.
+    // Neither is the depth format, so a capture can be replayed with any (see examples/replay.cpp).
+
+    // Writes the API calls made on a rasterizer to a capture file.
+    class Capture
+    {
+      public:
+        Capture(Rasterizer &r, const std::string &path);
+        bool ok() const;
+        int frames() const;
+
+        void useShaderProgram(const ShaderProgram &program);
+        void deleteShaderProgram(const ShaderProgram &program);
+        void setUniform(const ShaderProgram &program, const std::string &name);
+        void setVertexAttribs(const Object &object, int attribIndex, int n, int dim, const float *data);
+        void setTriangleIndices(const Object &object, int n, const glm::ivec3 *indices);
+        void enableDepthTest();
+        void clear(glm::vec4 color);
+        void drawObject(const Object &object);
+        void drawProxy(const Object &object);
+        void submit(const std::vector<const DrawCall *> &draws);
+        void show();
+
+      private:
+        // These return true if the program/object was seen for the first time,
+        // in which case its whole state has just been written out.
+        bool defineProgram(const ShaderProgram &program, int &id);
+        bool defineObject(const Object &object, int &id);
+
+        void op(CaptureOp op);
+        template <typename T> void write(const T &value);
+        void write(const std::string &str);
+        void writeBytes(const void *data, size_t size);
+        void writeUniforms(const Uniforms &uniforms);
+
+        Rasterizer &r;
+        std::ofstream out;
+        std::map<int, int> programs; // by ShaderProgram::capture_id
+        std::map<int, int> objects;  // by Object::capture_id
+        int next_id = 0;
+        int n_frames = 0;
+    };
+
+    // Loads a capture file and re-executes it on a rasterizer.
+    class Replay
+    {
+      public:
+        // Reads and decodes the whole file up front so that run() only measures rendering.
+        bool load(const std::string &path);
+
+        // Re-executes the capture on r, which should be initialized with the captured
+        // width, height and spp. Can be called any number of times.
+        // Returns the time taken by each frame (up to and including its show()) in microseconds.
+        std::vector<double> run(Rasterizer &r);
+
+        int width = 0, height = 0, spp = 1;
+        int frames = 0;
+
+      private:
+        struct SubmitDraw
+        {
+            int program, object;
+            Uniforms uniforms;
+        };
+
+        struct Record
+        {
+            CaptureOp op;
+            int id = -1;
+            int a = 0, b = 0, c = 0;
+            std::string vs, fs, name;
+            glm::vec4 color;
+            Uniforms uniforms;
+            std::vector<char> bytes;
+            std::vector<float> floats;
+            std::vector<glm::ivec3> indices;
+            std::vector<SubmitDraw> draws;
+        };
+
+        std::vector<Record> records;
+    };
+
+} // namespace Software
+} // namespace COL781
+
+#endif
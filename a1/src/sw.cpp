@@ -1,11 +1,21 @@
 #include "SDL2/SDL_pixels.h"
 #define GLM_SWIZZLE
 #include "sw.hpp"
+#include "capture.hpp"
 
 #include <iostream>
 #include <thread>
 #include <mutex>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace COL781
 {
@@ -32,59 +42,89 @@ namespace Software
     /// Built-in shaders
     ////////////////////////////////////////////////////////////////////////////
 
+    // The shaders themselves don't depend on the rasterizer, so they can be named without one.
+
+    static glm::vec4 vs_identity(const Uniforms &uniforms, const Attribs &in, Attribs &out)
+    {
+        glm::vec4 vertex = in.get<glm::vec4>(0);
+        return vertex;
+    }
+
+    static glm::vec4 vs_transform(const Uniforms &uniforms, const Attribs &in, Attribs &out)
+    {
+        glm::vec4 vertex = in.get<glm::vec4>(0);
+        glm::mat4 transform = uniforms.get<glm::mat4>("transform");
+        return transform * vertex;
+    }
+
+    static glm::vec4 vs_color(const Uniforms &uniforms, const Attribs &in, Attribs &out)
+    {
+        glm::vec4 vertex = in.get<glm::vec4>(0);
+        glm::vec4 color = in.get<glm::vec4>(1);
+        out.set<glm::vec4>(0, color);
+        return vertex;
+    }
+
+    // Dont' know why this didn't come implemnted.
+    static glm::vec4 vs_color_transform(const Uniforms &uniforms, const Attribs &in, Attribs &out)
+    {
+        glm::vec4 vertex = in.get<glm::vec4>(0);
+        glm::vec4 color = in.get<glm::vec4>(1);
+        glm::mat4 transform = uniforms.get<glm::mat4>("transform");
+        out.set<glm::vec4>(0, color);
+        return transform * vertex;
+    }
+
+    static glm::vec4 fs_constant(const Uniforms &uniforms, const Attribs &in)
+    {
+        glm::vec4 color = uniforms.get<glm::vec4>("color");
+        return color;
+    }
+
+    static glm::vec4 fs_identity(const Uniforms &uniforms, const Attribs &in)
+    {
+        glm::vec4 color = in.get<glm::vec4>(0);
+        return color;
+    }
+
     VertexShader Rasterizer::vsIdentity()
     {
-        return [](const Uniforms &uniforms, const Attribs &in, Attribs &out) {
-            glm::vec4 vertex = in.get<glm::vec4>(0);
-            return vertex;
-        };
+        return vs_identity;
     }
 
     VertexShader Rasterizer::vsTransform()
     {
-        return [](const Uniforms &uniforms, const Attribs &in, Attribs &out) {
-            glm::vec4 vertex = in.get<glm::vec4>(0);
-            glm::mat4 transform = uniforms.get<glm::mat4>("transform");
-            return transform * vertex;
-        };
+        return vs_transform;
     }
 
     VertexShader Rasterizer::vsColor()
     {
-        return [](const Uniforms &uniforms, const Attribs &in, Attribs &out) {
-            glm::vec4 vertex = in.get<glm::vec4>(0);
-            glm::vec4 color = in.get<glm::vec4>(1);
-            out.set<glm::vec4>(0, color);
-            return vertex;
-        };
+        return vs_color;
     }
 
-    // Dont' know why this didn't come implemnted.
     VertexShader Rasterizer::vsColorTransform()
     {
-        return [](const Uniforms &uniforms, const Attribs &in, Attribs &out) {
-            glm::vec4 vertex = in.get<glm::vec4>(0);
-            glm::vec4 color = in.get<glm::vec4>(1);
-            glm::mat4 transform = uniforms.get<glm::mat4>("transform");
-            out.set<glm::vec4>(0, color);
-            return transform * vertex;
-        };
+        return vs_color_transform;
     }
 
     FragmentShader Rasterizer::fsConstant()
     {
-        return [](const Uniforms &uniforms, const Attribs &in) {
-            glm::vec4 color = uniforms.get<glm::vec4>("color");
-            return color;
-        };
+        return fs_constant;
     }
 
     FragmentShader Rasterizer::fsIdentity()
     {
-        return [](const Uniforms &uniforms, const Attribs &in) {
-            glm::vec4 color = in.get<glm::vec4>(0);
-            return color;
-        };
+        return fs_identity;
+    }
+
+    void Rasterizer::builtinShaders(std::map<std::string, VertexShader> &vs, std::map<std::string, FragmentShader> &fs)
+    {
+        vs["vsIdentity"] = vs_identity;
+        vs["vsColor"] = vs_color;
+        vs["vsTransform"] = vs_transform;
+        vs["vsColorTransform"] = vs_color_transform;
+        fs["fsConstant"] = fs_constant;
+        fs["fsIdentity"] = fs_identity;
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -109,7 +149,7 @@ namespace Software
     }
 
     // clang-format off
-    int Attribs::size() { return values.size(); }
+    int Attribs::size() const { return values.size(); }
 
     template <> float     Attribs::get(int index) const { checkDimension(index, dims[index], 1); return values[index].x; }
     template <> glm::vec2 Attribs::get(int index) const { checkDimension(index, dims[index], 2); return glm::vec2(values[index].x, values[index].y); }
@@ -121,17 +161,45 @@ namespace Software
     template <> void Attribs::set(int index, glm::vec3 value) { expand(dims, values, index); dims[index] = 3; values[index] = glm::vec4(value, 0); }
     template <> void Attribs::set(int index, glm::vec4 value) { expand(dims, values, index); dims[index] = 4; values[index] = value; }
 
+    // clang-format on
+
+    void Uniforms::setRaw(const std::string &name, const void *data, size_t size)
+    {
+        std::shared_ptr<void> copy(new char[size], [](void *p) { delete[] (char *)p; });
+        memcpy(copy.get(), data, size);
+        values[name] = {copy, size};
+    }
+
+    std::vector<std::string> Uniforms::names() const
+    {
+        std::vector<std::string> names;
+        for (const auto &entry : values)
+        {
+            names.push_back(entry.first);
+        }
+        return names;
+    }
+
+    const void *Uniforms::getRaw(const std::string &name, size_t &size) const
+    {
+        const Value &value = values.at(name);
+        size = value.size;
+        return value.data.get();
+    }
+
+    // clang-format off
+
     // Uniforms::get, Uniforms::set in sw.hpp
     // Type constraining setUniform down here.
 
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, float     value) { sp.uniforms.set<float>    (name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, int       value) { sp.uniforms.set<int>      (name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec2 value) { sp.uniforms.set<glm::vec2>(name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat2 value) { sp.uniforms.set<glm::mat2>(name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec3 value) { sp.uniforms.set<glm::vec3>(name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat3 value) { sp.uniforms.set<glm::mat3>(name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec4 value) { sp.uniforms.set<glm::vec4>(name, value); }
-    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat4 value) { sp.uniforms.set<glm::mat4>(name, value); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, float     value) { sp.uniforms.set<float>    (name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, int       value) { sp.uniforms.set<int>      (name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec2 value) { sp.uniforms.set<glm::vec2>(name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat2 value) { sp.uniforms.set<glm::mat2>(name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec3 value) { sp.uniforms.set<glm::vec3>(name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat3 value) { sp.uniforms.set<glm::mat3>(name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec4 value) { sp.uniforms.set<glm::vec4>(name, value); if (capture) capture->setUniform(sp, name); }
+    template <> void Rasterizer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat4 value) { sp.uniforms.set<glm::mat4>(name, value); if (capture) capture->setUniform(sp, name); }
 
     // clang-format on 
 
@@ -139,6 +207,17 @@ namespace Software
     /// Rasterizer windowing methods
     ////////////////////////////////////////////////////////////////////////////
 
+    // COL781_TERMINAL=<columns>[x<rows>]
+    void beginTerminalOutputFromEnv(Rasterizer &r)
+    {
+        const char *size = getenv("COL781_TERMINAL");
+        if (size == nullptr)
+            return;
+        int columns = 0, rows = 0;
+        sscanf(size, "%dx%d", &columns, &rows);
+        r.beginTerminalOutput(columns, rows);
+    }
+
     bool Rasterizer::initialize(const std::string &title, int width, int height, int spp)
     {
         bool success = true;
@@ -161,20 +240,105 @@ namespace Software
             }
             else
             {
-                int mult = sqrt(spp);
-                framebuffer =
-                    SDL_CreateRGBSurface(0, width*mult, height*mult, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0);
-                    // SDL_CreateRGBSurface(0, width*mult, height*mult, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+                createFramebuffer(width, height, spp);
             }
-            rtp = new RasterizerThreadPool(4);
-            rtp->framebuffer = &framebuffer;
-            rtp->program = &shader_program;
-            rtp->z_buffer = &z_buffer;
             // scaling interpolation 
         }
+        const char *capture_path = getenv("COL781_CAPTURE");
+        if (success && capture_path != nullptr)
+        {
+            const char *frames = getenv("COL781_CAPTURE_FRAMES");
+            capture_frames = frames != nullptr ? atoi(frames) : -1;
+            beginCapture(capture_path);
+        }
+        if (success)
+            beginTerminalOutputFromEnv(*this);
         return success;
     }
 
+    bool Rasterizer::initializeHeadless(int width, int height, int spp)
+    {
+        SDL_FreeSurface(offscreen);
+        offscreen = SDL_CreateRGBSurface(0, width, height, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+        if (offscreen == NULL)
+        {
+            printf("Offscreen surface could not be created! SDL_Error: %s", SDL_GetError());
+            return false;
+        }
+        createFramebuffer(width, height, spp);
+        beginTerminalOutputFromEnv(*this);
+        return true;
+    }
+
+    void Rasterizer::beginTerminalOutput(int columns, int rows)
+    {
+        endTerminalOutput();
+        terminal = new Core::TerminalDisplay(columns, rows);
+        std::fill(tile_dirty.begin(), tile_dirty.end(), 1);
+    }
+
+    void Rasterizer::endTerminalOutput()
+    {
+        delete terminal;
+        terminal = nullptr;
+    }
+
+    Rasterizer::~Rasterizer()
+    {
+        endCapture();
+        endTerminalOutput();
+        delete rtp; // joins the workers
+        SDL_FreeSurface(framebuffer);
+        SDL_FreeSurface(offscreen);
+    }
+
+    void Rasterizer::createFramebuffer(int width, int height, int spp)
+    {
+        this->spp = spp;
+        int mult = sqrt(spp);
+        SDL_FreeSurface(framebuffer);
+        framebuffer = SDL_CreateRGBSurface(0, width * mult, height * mult, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+        // SDL_CreateRGBSurface(0, width*mult, height*mult, 32, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+        if (rtp == nullptr)
+            rtp = new Core::ThreadPool(4);
+        binner = Core::TileBinner(framebuffer->w, framebuffer->h, mult, rtp->size() + 1);
+        resetTiles(false);
+    }
+
+    // Lays out the per-tile state for the binner's current tile grid. After a
+    // retune nothing is known about the new tiles, so everything is assumed touched.
+    void Rasterizer::resetTiles(bool retune)
+    {
+        tile_size = binner.tileSize();
+        tiles_x = binner.tilesX();
+        tiles_y = binner.tilesY();
+        int n = tiles_x * tiles_y;
+        tile_dirty.assign(n, 1);
+        tile_cleared.assign(n, 0);
+        tile_depth.assign(n, retune);
+        tile_hiz.assign(n, depthClearValue());
+        tile_hiz_stale.assign(n, retune);
+    }
+
+    const Core::TilingStats &Rasterizer::getTilingStats() const
+    {
+        return binner.tuner().stats();
+    }
+
+    // The framebuffer rows covered by tile t. Tiles are numbered bottom-up like
+    // pixel coordinates, while the framebuffer is stored top-down.
+    SDL_Rect Rasterizer::tileRect(int t) const
+    {
+        int x0 = (t % tiles_x) * tile_size, y0 = (t / tiles_x) * tile_size;
+        int x1 = std::min(framebuffer->w, x0 + tile_size), y1 = std::min(framebuffer->h, y0 + tile_size);
+        return SDL_Rect{x0, framebuffer->h - y1, x1 - x0, y1 - y0};
+    }
+
+    SDL_Surface *Rasterizer::getDisplaySurface()
+    {
+        return window != nullptr ? SDL_GetWindowSurface(window) : offscreen;
+    }
+
     bool Rasterizer::shouldQuit()
     {
         SDL_Event e;
@@ -204,6 +368,8 @@ namespace Software
     void Rasterizer::useShaderProgram(const ShaderProgram &program)
     {
         shader_program = &program;
+        if (capture)
+            capture->useShaderProgram(program);
     }
 
     void Rasterizer::deleteShaderProgram(ShaderProgram &program)
@@ -212,6 +378,8 @@ namespace Software
         {
             shader_program = nullptr;
         }
+        if (capture)
+            capture->deleteShaderProgram(program);
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -278,7 +446,7 @@ namespace Software
     }
 
     glm::vec4 getAttribs(const Object &object, int attribIndex, int n, int dim) {
-        Object::Buffer buf = object.attributeValues[attribIndex];
+        const Object::Buffer &buf = object.attributeValues[attribIndex];
         switch (dim) {
             case 1: return glm::vec4(buf[dim*n + 0], 0, 0, 0);
             case 2: return glm::vec4(buf[dim*n + 0], buf[dim*n + 1], 0, 0);
@@ -290,10 +458,10 @@ namespace Software
     }
 
     // clang-format off
-    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const float     *data) { setAttribs(object, attribIndex, n, 1, (float *)data); }
-    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const glm::vec2 *data) { setAttribs(object, attribIndex, n, 2, (float *)data); }
-    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const glm::vec3 *data) { setAttribs(object, attribIndex, n, 3, (float *)data); }
-    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const glm::vec4 *data) { setAttribs(object, attribIndex, n, 4, (float *)data); }
+    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const float     *data) { setAttribs(object, attribIndex, n, 1, (float *)data); if (capture) capture->setVertexAttribs(object, attribIndex, n, 1, (const float *)data); }
+    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const glm::vec2 *data) { setAttribs(object, attribIndex, n, 2, (float *)data); if (capture) capture->setVertexAttribs(object, attribIndex, n, 2, (const float *)data); }
+    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const glm::vec3 *data) { setAttribs(object, attribIndex, n, 3, (float *)data); if (capture) capture->setVertexAttribs(object, attribIndex, n, 3, (const float *)data); }
+    template <> void Rasterizer::setVertexAttribs(Object &object, int attribIndex, int n, const glm::vec4 *data) { setAttribs(object, attribIndex, n, 4, (float *)data); if (capture) capture->setVertexAttribs(object, attribIndex, n, 4, (const float *)data); }
     // clang-format on
 
     void Rasterizer::setTriangleIndices(Object &object, int n, glm::ivec3 *indices)
@@ -303,133 +471,12 @@ namespace Software
         {
             object.indices[i] = indices[i];
         }
+        if (capture)
+            capture->setTriangleIndices(object, n, indices);
 
         // printObject(object);
     }
 
-    ////////////////////////////////////////////////////////////////////////////
-    /// RasterizerThreadPool
-    ////////////////////////////////////////////////////////////////////////////
-
-    RasterizerThreadPool::RasterizerThreadPool(size_t n_threads)
-        : _n_threads(n_threads), _threads(n_threads),
-          _workqueues(n_threads, std::vector<std::pair<glm::ivec2, glm::ivec2>>()), _next_workq{0}, _alive{true},
-          _work{false}
-    {
-
-        _alive = true;
-        for (int i = 0; i < _n_threads; i++)
-        {
-            // TODO CPU affinity - not so easy to set in a cross-platform manner.
-            // Especially hard (impossible?) to do on MacOS w/ arm processors
-            _threads[i] = std::thread([this, i] { this->_thread_fn(i); });
-        }
-    }
-
-    RasterizerThreadPool::~RasterizerThreadPool()
-    {
-        if (_alive)
-        {
-            this->stop();
-        }
-    }
-
-    void RasterizerThreadPool::_thread_fn(int index)
-    {
-        while (_alive)
-        {
-            /*{
-                std::lock_guard<std::mutex> l(mtx);
-                std::cout << "Alive" << std::endl;
-            }*/
-            if (!_work[index])
-                continue;
-            // do work
-            /*{
-                std::lock_guard<std::mutex> l(mtx);
-                std::cout << "Working" << std::endl;
-            }*/
-            while (!_workqueues[index].empty())
-            {
-                auto [tl, br] = _workqueues[index].back();
-                _fn(index, *framebuffer, *program, *z_buffer, _tri, _attrs, tl, br);
-                _workqueues[index].pop_back();
-            }
-            // turn self off
-            _work[index] = false;
-        }
-    }
-
-    void RasterizerThreadPool::start()
-    {
-        if (!_alive)
-        {
-            _alive = true;
-            for (int i = 0; i < _n_threads; i++)
-            {
-                // TODO CPU affinity - not so easy to set in a cross-platform manner.
-                // Especially hard (impossible?) to do on MacOS w/ arm processors
-                _threads[i] = std::thread([this, i] { this->_thread_fn(i); });
-            }
-        }
-    }
-
-    void RasterizerThreadPool::run()
-    {
-        // all of _work[i] guaranteed to be false here
-        for (int i = 0; i < _n_threads; i++)
-        {
-            _work[i] = true;
-        }
-
-        // std::cout << "Set all threads to work. Waiting on work status." << std::endl;
-
-        // see the work status
-        bool all_free = false;
-        while (!all_free)
-        {
-            all_free = true;
-            for (int i = 0; i < _n_threads; i++)
-            {
-                all_free = (all_free && (!_work[i]));
-            }
-        }
-    }
-
-    void RasterizerThreadPool::stop()
-    {
-        _alive = false;
-        for (int i = 0; i < _n_threads; i++)
-        {
-            _threads[i].join();
-        }
-    }
-
-    // obviously don't call this after run has been called!
-    void RasterizerThreadPool::enqueue(glm::ivec2 tl, glm::ivec2 br)
-    {
-        _workqueues[_next_workq].push_back({tl, br});
-        _next_workq = (_next_workq + 1) % _n_threads;
-    }
-
-    void RasterizerThreadPool::set_render_function(
-        std::function<void(int, SDL_Surface *, const ShaderProgram *, float *, glm::vec4 (&)[3], Attribs (&)[3],
-                           glm::ivec2 &, glm::ivec2 &)>
-            fn)
-    {
-        _fn = fn;
-    }
-
-    void RasterizerThreadPool::set_triangle_data(glm::vec4 (&tri)[3], Attribs (&attrs)[3])
-    {
-        _tri[0] = tri[0];
-        _tri[1] = tri[1];
-        _tri[2] = tri[2];
-        _attrs[0] = attrs[0];
-        _attrs[1] = attrs[1];
-        _attrs[2] = attrs[2];
-    }
-
     ////////////////////////////////////////////////////////////////////////////
     /// Rendering
     ////////////////////////////////////////////////////////////////////////////
@@ -471,40 +518,66 @@ namespace Software
         return glm::ivec2(((pt.x + 1) * w) / 2 - 0.5, ((pt.y + 1) * h) / 2 - 0.5);
     }
 
-    Uint32 vec4_to_color(SDL_PixelFormat *fmt, glm::vec4 &color)
+    // The framebuffer always holds 0xAARRGGBB pixels (SDL ignores the alpha byte),
+    // so fragments are packed here instead of through SDL_MapRGBA. Conversion to
+    // the window's pixel format happens once per pixel, when show() resolves a tile.
+    Uint32 pack_color(const glm::vec4 &color)
     {
-        return SDL_MapRGBA(fmt, (Uint8)(color[0] * 255), (Uint8)(color[1] * 255), (Uint8)(color[2] * 255),
-                           (Uint8)(color[3] * 255));
+        auto to_byte = [](float c) { return (Uint32)(fminf(fmaxf(c, 0.0f), 1.0f) * 255); };
+        return to_byte(color[3]) << 24 | to_byte(color[0]) << 16 | to_byte(color[1]) << 8 | to_byte(color[2]);
     }
 
-    glm::vec3 flatten(glm::vec4 hom)
+    // Same as pack_color, four colors at a time where SIMD is available.
+    void pack_colors(const glm::vec4 *colors, Uint32 *out, int n)
     {
-        return hom.xyz() / hom.w;
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f);
+        auto to_byte = [&](__m128 c) { return _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(c, zero), one), scale)); };
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 r = _mm_loadu_ps(&colors[i][0]), g = _mm_loadu_ps(&colors[i + 1][0]);
+            __m128 b = _mm_loadu_ps(&colors[i + 2][0]), a = _mm_loadu_ps(&colors[i + 3][0]);
+            _MM_TRANSPOSE4_PS(r, g, b, a);
+            __m128i px = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(to_byte(a), 24), _mm_slli_epi32(to_byte(r), 16)),
+                                      _mm_or_si128(_mm_slli_epi32(to_byte(g), 8), to_byte(b)));
+            _mm_storeu_si128((__m128i *)(out + i), px);
+        }
+#elif defined(__ARM_NEON)
+        const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f), scale = vdupq_n_f32(255.0f);
+        auto to_byte = [&](float32x4_t c) { return vcvtq_u32_f32(vmulq_f32(vminq_f32(vmaxq_f32(c, zero), one), scale)); };
+        for (; i + 4 <= n; i += 4)
+        {
+            float32x4x4_t c = vld4q_f32(&colors[i][0]); // deinterleaved into r, g, b, a
+            uint32x4_t px = vorrq_u32(vorrq_u32(vshlq_n_u32(to_byte(c.val[3]), 24), vshlq_n_u32(to_byte(c.val[0]), 16)),
+                                      vorrq_u32(vshlq_n_u32(to_byte(c.val[1]), 8), to_byte(c.val[2])));
+            vst1q_u32(out + i, px);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            out[i] = pack_color(colors[i]);
+        }
     }
 
-    glm::vec3 phi(glm::vec2 (&tri)[3], glm::vec2 pt)
+    glm::vec3 flatten(glm::vec4 hom)
     {
-        float denominator = (tri[0].x * (tri[1].y - tri[2].y) + tri[0].y * (tri[2].x - tri[1].x) + tri[1].x * tri[2].y -
-                             tri[1].y * tri[2].x);
-        float t1 =
-            (pt.x * (tri[2].y - tri[0].y) + pt.y * (tri[0].x - tri[2].x) - tri[0].x * tri[2].y + tri[0].y * tri[2].x) /
-            denominator;
-        float t2 =
-            -(pt.x * (tri[1].y - tri[0].y) + pt.y * (tri[0].x - tri[1].x) - tri[0].x * tri[1].y + tri[0].y * tri[1].x) /
-            denominator;
-        float s = 1 - t1 - t2;
-        return glm::vec3(s, t1, t2);
+        return hom.xyz() / hom.w;
     }
 
-    glm::vec3 phi_pc(glm::vec4 (&hom_tri)[3], glm::vec3 p, glm::vec2 pt)
+    // A vec4 varying over a triangle as planes over NDC, value = dx * x + dy * y + c.
+    struct VaryingPlane
     {
-        float norm = (p[0] / hom_tri[0].w + p[1] / hom_tri[1].w + p[2] / hom_tri[2].w);
-        return glm::vec3((p[0] / hom_tri[0].w) / norm, (p[1] / hom_tri[1].w) / norm, (p[2] / hom_tri[2].w) / norm);
-    }
+        glm::vec4 dx, dy, c;
+    };
 
-    glm::vec4 interpolate(glm::vec4 (&vert_attribs)[3], glm::vec3 wts)
+    // The planes taking the values a[k] at the triangle's vertices.
+    VaryingPlane varying_plane(const Core::TriangleSetup &setup, const glm::vec4 (&a)[3])
     {
-        return wts[0] * vert_attribs[0] + wts[1] * vert_attribs[1] + wts[2] * vert_attribs[2];
+        const Core::Plane(&t)[2] = setup.bary;
+        glm::vec4 d1 = a[1] - a[0], d2 = a[2] - a[0];
+        VaryingPlane plane = {d1 * t[0].a + d2 * t[1].a, d1 * t[0].b + d2 * t[1].b, a[0] + d1 * t[0].c + d2 * t[1].c};
+        return plane;
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -513,233 +586,729 @@ namespace Software
 
     void Rasterizer::enableDepthTest()
     {
+        if (capture)
+            capture->enableDepthTest();
+        if (depth_enabled)
+            return;
         depth_enabled = true;
-        z_buffer = new float[framebuffer->w * framebuffer->h];
-        for (int i = 0; i < framebuffer->w; i++)
+        allocateDepth();
+    }
+
+    void Rasterizer::setDepthFormat(Core::DepthFormat format)
+    {
+        if (format == depth_format)
+            return;
+        depth_format = format;
+        if (depth_enabled)
+            allocateDepth();
+    }
+
+    Core::DepthFormat Rasterizer::getDepthFormat() const
+    {
+        return depth_format;
+    }
+
+    const DepthStats &Rasterizer::getDepthStats() const
+    {
+        return depth_stats;
+    }
+
+    template <Core::DepthFormat F> void fill_depth(void *zb, int w, const SDL_Rect &rect)
+    {
+        typedef typename Core::Depth<F>::Value Value;
+        for (int i = rect.y; i < rect.y + rect.h; i++)
         {
-            for (int j = 0; j < framebuffer->h; j++)
-            {
-                z_buffer[framebuffer->h * i + j] = 1;
-            }
+            std::fill_n((Value *)zb + i * w + rect.x, rect.w, Core::Depth<F>::clearValue());
+        }
+    }
+
+    // Sets rect of the depth buffer (in framebuffer rows) to the far value.
+    void Rasterizer::fillDepth(const SDL_Rect &rect)
+    {
+        switch (depth_format)
+        {
+        case Core::DepthFormat::Float32:
+            fill_depth<Core::DepthFormat::Float32>(z_buffer.data(), framebuffer->w, rect);
+            break;
+        case Core::DepthFormat::Float32Reversed:
+            fill_depth<Core::DepthFormat::Float32Reversed>(z_buffer.data(), framebuffer->w, rect);
+            break;
+        case Core::DepthFormat::Unorm16:
+            fill_depth<Core::DepthFormat::Unorm16>(z_buffer.data(), framebuffer->w, rect);
+            break;
         }
     }
 
+    // The far value as stored in tile_hiz.
+    float Rasterizer::depthClearValue() const
+    {
+        switch (depth_format)
+        {
+        case Core::DepthFormat::Float32Reversed:
+            return Core::Depth<Core::DepthFormat::Float32Reversed>::clearValue();
+        case Core::DepthFormat::Unorm16:
+            return Core::Depth<Core::DepthFormat::Unorm16>::clearValue();
+        default:
+            return Core::Depth<Core::DepthFormat::Float32>::clearValue();
+        }
+    }
+
+    // (Re)creates the depth buffer in the current format, cleared.
+    void Rasterizer::allocateDepth()
+    {
+        z_buffer.assign(long(framebuffer->w) * framebuffer->h * Core::depthBytes(depth_format), 0);
+        fillDepth(SDL_Rect{0, 0, framebuffer->w, framebuffer->h});
+        std::fill(tile_depth.begin(), tile_depth.end(), 0);
+        std::fill(tile_hiz.begin(), tile_hiz.end(), depthClearValue());
+        std::fill(tile_hiz_stale.begin(), tile_hiz_stale.end(), 0);
+    }
+
     void Rasterizer::clear(glm::vec4 color)
     {
-        SDL_FillRect(framebuffer, NULL, vec4_to_color(framebuffer->format, color));
+        if (capture)
+            capture->clear(color);
+
+        // only touch the tiles that hold anything other than this color
+        Uint32 c = pack_color(color);
+        std::vector<int> stale;
+        for (int t = 0; t < tile_cleared.size(); t++)
+        {
+            if (!tile_cleared[t] || c != clear_color)
+                stale.push_back(t);
+        }
+        if (stale.size() == tile_cleared.size())
+        {
+            SDL_FillRect(framebuffer, NULL, c);
+        }
+        else
+        {
+            for (int t : stale)
+            {
+                SDL_Rect rect = tileRect(t);
+                SDL_FillRect(framebuffer, &rect, c);
+            }
+        }
+        for (int t : stale)
+        {
+            tile_dirty[t] = 1;
+            tile_cleared[t] = 1;
+        }
+        clear_color = c;
+
         if (depth_enabled)
         {
-            for (int i = 0; i < framebuffer->w; i++)
+            for (int t = 0; t < tile_depth.size(); t++)
             {
-                for (int j = 0; j < framebuffer->h; j++)
-                {
-                    z_buffer[framebuffer->h * i + j] = 1;
-                }
+                if (!tile_depth[t])
+                    continue;
+                SDL_Rect rect = tileRect(t);
+                fillDepth(rect);
+                depth_stats.bytes_written += long(rect.w) * rect.h * Core::depthBytes(depth_format);
+                tile_depth[t] = 0;
+                tile_hiz[t] = depthClearValue();
+                tile_hiz_stale[t] = 0;
             }
         }
     }
 
-#define pix2pt(x, y, p) glm::vec2((2 * (x) + 1) * p[0] - 1, (2 * (y) + 1) * p[1] - 1)
-#define pt2pix(x, y, p) glm::ivec2(round(((x) + 1) / (2 * p[0]) - 0.5f), round(((y) + 1) / (2 * p[1]) - 0.5f))
+    // A triangle of the batch being executed, set up once before binning and shared
+    // read-only by the tiles it lands in.
+    struct BatchTriangle
+    {
+        Core::TriangleSetup setup;
+        Core::Plane inv_w; // 1 / w, which is linear in screen space
+        Core::Plane z;     // depth / w, divided by w like the varyings; times the fragment's w, its depth
+        float znear;       // nearest vertex depth as stored, for proxies and Hi-Z
+        glm::ivec4 v;      // (draw, global vertex indices)
+        int varyings;      // first of the triangle's varying planes (divided by w) in the batch
+        int n_varyings;
+    };
+
+    // Sets up the depth plane and nearest depth of a triangle with clip positions hom in format F.
+    template <Core::DepthFormat F>
+    void setup_depth(BatchTriangle &tri, const glm::vec4 (&hom)[3], const float (&inv_w)[3])
+    {
+        typedef Core::Depth<F> Depth;
+        float d[3] = {Depth::value(hom[0]), Depth::value(hom[1]), Depth::value(hom[2])};
+        tri.z = tri.setup.interpolate(d[0] * inv_w[0], d[1] * inv_w[1], d[2] * inv_w[2]);
+        typename Depth::Value znear = Depth::store(d[0]);
+        for (int k = 1; k < 3; k++)
+        {
+            typename Depth::Value dk = Depth::store(d[k]);
+            if (!Depth::passes(znear, dk))
+                znear = dk;
+        }
+        tri.znear = znear;
+    }
 
-    void rasterize_block(int idx,                                             // thread index
-                         SDL_Surface *fb, const ShaderProgram *sp, float *zb, // common buffers to write to
-                         glm::vec4 (&hom_tri)[3], Attribs (&attrs)[3],        // triangle-specific attributes
-                         glm::ivec2 &tl, glm::ivec2 &br                       // top-left and bottom-right pixel bounds
-    )
+    // Shades the part of a triangle inside the block and returns the number of samples written.
+    // tests counts the depth tests made. row_start is the calling thread's scratch space, kept
+    // across calls so that small triangles don't allocate on every tile.
+    template <Core::DepthFormat F>
+    long rasterize_block(SDL_Surface *fb, const ShaderProgram *sp, const Uniforms &uniforms, // common state
+                         typename Core::Depth<F>::Value *zb, long &tests,                    // depth buffer, if enabled
+                         const BatchTriangle &tri, const VaryingPlane *varyings, // triangle and its varyings
+                         glm::ivec2 tl, glm::ivec2 br, // top-left and bottom-right pixel bounds
+                         std::vector<glm::vec4> &row_start)
     {
+        typedef Core::Depth<F> Depth;
 
-        // std::cout << "In rasterize_block" << std::endl;
         Uint32 *pixels = (Uint32 *)fb->pixels;
-        SDL_PixelFormat *format = fb->format;
         int h = fb->h;
         int w = fb->w;
-        glm::vec2 p(1.0f / w, 1.0f / h);
-        glm::vec2 tri[3] = {flatten(hom_tri[0]).xy(), flatten(hom_tri[1]).xy(), flatten(hom_tri[2]).xy()};
 
-        // square ignore test:
-        //    for all edges of the triangle
-        //        check if the other point of the triangle is on the opposite side
-        //        compared to all four points of the square
+        // shaded colors are packed in batches
+        const int batch = 8;
+        glm::vec4 colors[batch];
+        Uint32 *targets[batch], packed[batch];
+        int n_shaded = 0;
+        auto flush = [&]() {
+            pack_colors(colors, packed, n_shaded);
+            for (int k = 0; k < n_shaded; k++)
+            {
+                *targets[k] = packed[k];
+            }
+            n_shaded = 0;
+        };
 
-        glm::vec2 p1 = pix2pt(tl.x, tl.y, p);
-        glm::vec2 p2 = pix2pt(tl.x, br.y, p);
-        glm::vec2 p3 = pix2pt(br.x, br.y, p);
-        glm::vec2 p4 = pix2pt(br.x, tl.y, p);
+        // the varyings are advanced along each row from its start, and only multiplied by w per fragment
+        Attribs interp_attrs;
+        if ((int)row_start.size() < tri.n_varyings)
+            row_start.resize(tri.n_varyings);
+        int row = -1;
 
-        // std::cout << "Rasterizing" << std::endl;
+        long samples = Core::rasterizeBlock(tri.setup, tl, br, w, h, [&](int x, int y, glm::vec2 px, glm::vec3 p) -> bool {
+            float frag_w = 1 / tri.inv_w.at(px);
+            if (zb != nullptr)
+            {
+                typename Depth::Value z = Depth::store(tri.z.at(px) * frag_w);
+                tests++;
+                if (!Depth::passes(z, zb[(h - y - 1) * w + x]))
+                {
+                    return false; // discard fragment
+                }
+                zb[(h - y - 1) * w + x] = z;
+            }
 
-        for (int k = 0; k < 3; k++)
-        {
-            auto v1 = tri[k % 3];
-            auto v2 = tri[(k + 1) % 3];
-            auto v3 = tri[(k + 2) % 3];
+            // interpolate attributes
+            if (y != row)
+            {
+                row = y;
+                for (int i = 0; i < tri.n_varyings; i++)
+                {
+                    row_start[i] = varyings[i].dy * px.y + varyings[i].c;
+                }
+            }
+            for (int i = 0; i < tri.n_varyings; i++)
+            {
+                interp_attrs.set<glm::vec4>(i, (varyings[i].dx * px.x + row_start[i]) * frag_w);
+            }
 
-            auto s = v2 - v1;
-            glm::vec2 n(-s.y, s.x);
-            float t = glm::dot(n, v3 - v1);
+            colors[n_shaded] = sp->fs(uniforms, interp_attrs);
+            targets[n_shaded] = &pixels[(h - y - 1) * w + x];
+            if (++n_shaded == batch)
+                flush();
+            return true;
+        });
+        flush();
+        return samples;
+    }
 
-            float d1 = glm::dot((p1 - v1), n);
-            float d2 = glm::dot((p2 - v1), n);
-            float d3 = glm::dot((p3 - v1), n);
-            float d4 = glm::dot((p4 - v1), n);
+    // Counts the samples in the block that a proxy triangle could cover with its nearest depth
+    // still passing the depth test, without writing anything. A pixel counts if the triangle
+    // touches any part of it, and the triangle is tested at its nearest vertex depth.
+    template <Core::DepthFormat F>
+    long rasterize_proxy_block(SDL_Surface *fb, typename Core::Depth<F>::Value *zb, long &tests,
+                               const BatchTriangle &tri, glm::ivec2 tl, glm::ivec2 br)
+    {
+        typedef Core::Depth<F> Depth;
+        int h = fb->h;
+        int w = fb->w;
+        glm::vec2 p(1.0f / w, 1.0f / h);
+        const glm::vec2 *v = tri.setup.v;
 
-            if (d1 * t < 0 && d2 * t < 0 && d3 * t < 0 && d4 * t < 0)
-            {
-                // tri outside sq
-                return;
-            }
-        }
+        // bounding box, grown by a pixel so that partially covered pixels are kept
+        float xmin = fminf(v[0].x, fminf(v[1].x, v[2].x)), ymin = fminf(v[0].y, fminf(v[1].y, v[2].y));
+        float xmax = fmaxf(v[0].x, fmaxf(v[1].x, v[2].x)), ymax = fmaxf(v[0].y, fmaxf(v[1].y, v[2].y));
+        glm::ivec2 bb_tl = Core::nearestPixel(glm::vec2(xmin, ymin), p) - glm::ivec2(1);
+        glm::ivec2 bb_br = Core::nearestPixel(glm::vec2(xmax, ymax), p) + glm::ivec2(1);
 
-        for (int y = std::max(0, tl.y); y <= std::min(h - 1, br.y); y++)
+        typename Depth::Value znear = tri.znear;
+        long samples = 0;
+        for (int y = std::max({0, tl.y, bb_tl.y}); y <= std::min({h - 1, br.y, bb_br.y}); y++)
         {
-            for (int x = std::max(0, tl.x); x <= std::min(w - 1, br.x); x++)
+            for (int x = std::max({0, tl.x, bb_tl.x}); x <= std::min({w - 1, br.x, bb_br.x}); x++)
             {
-                glm::vec2 px = pix2pt(x, y, p);
-                glm::vec3 p = phi(tri, px);
-                glm::vec3 p_pc = phi_pc(hom_tri, p, px);
-
-                if (p[0] < 0 || p[1] < 0 || p[2] < 0)
-                    continue;
-
                 if (zb != nullptr)
                 {
-                    float z = hom_tri[0].z * p_pc[0] / hom_tri[0].w + hom_tri[1].z * p_pc[1] / hom_tri[1].w +
-                              hom_tri[2].z * p_pc[2] / hom_tri[2].w;
-                    if (z > zb[(h - y - 1) * w + x])
-                    {
-                        continue; // discard fragment
-                    }
-                    zb[(h - y - 1) * w + x] = z;
+                    tests++;
+                    if (!Depth::passes(znear, zb[(h - y - 1) * w + x]))
+                        continue;
                 }
 
-                // load and interpolate attributes
-                Attribs interp_attrs;
-                for (int i = 0; i < attrs[0].size(); i++)
-                {
-                    // assuming vec4 here.
-                    glm::vec4 vert_attribs[3] = {
-                        attrs[0].get<glm::vec4>(i),
-                        attrs[1].get<glm::vec4>(i),
-                        attrs[2].get<glm::vec4>(i),
-                    };
-                    interp_attrs.set<glm::vec4>(i, interpolate(vert_attribs, p_pc));
-                }
-
-                glm::vec4 color = sp->fs(sp->uniforms, interp_attrs);
-                pixels[(h - y - 1) * w + x] = vec4_to_color(format, color);
+                // the square ignore test, on the pixel's corners
+                glm::vec2 c = Core::pixelCenter(x, y, p);
+                if (!Core::outsideRect(tri.setup, c - p, c + p))
+                    samples++;
             }
         }
+        return samples;
     }
 
     // Draws the triangles of the given object.
     void Rasterizer::drawObject(const Object &object)
     {
-        // not sure how slow/fast spawning threads is, but the alternative is
-        // to sleep them. Let's see.
-        // rtp->start();
+        if (shader_program == nullptr)
+            return;
+        if (capture)
+            capture->drawObject(object);
+        DrawCall draw{shader_program, shader_program->uniforms, &object, false};
+        std::vector<const DrawCall *> draws = {&draw};
+        execute(draws);
+    }
+
+    void Rasterizer::drawProxy(const Object &object)
+    {
+        if (shader_program == nullptr)
+            return;
+        if (capture)
+            capture->drawProxy(object);
+        DrawCall draw{shader_program, shader_program->uniforms, &object, true};
+        std::vector<const DrawCall *> draws = {&draw};
+        execute(draws);
+    }
 
-        Uint32 *pixels = (Uint32 *)framebuffer->pixels;
-        SDL_PixelFormat *format = framebuffer->format;
-        int h = framebuffer->h;
-        int w = framebuffer->w;
-        glm::vec2 p(1.0f / w, 1.0f / h);
+    void Rasterizer::beginQuery(OcclusionQuery &query)
+    {
+        query.samples = 0;
+        this->query = &query;
+    }
+
+    void Rasterizer::endQuery()
+    {
+        query = nullptr;
+    }
 
-        int vertex_count = object.attributeValues[0].size() / object.attributeDims[0];
-        std::vector<Attribs> vertex_in_attrs(vertex_count);
-        std::vector<Attribs> vertex_out_attrs(vertex_count);
-        std::vector<glm::vec4> vertex_pos(vertex_count);
+    void Rasterizer::submit(const CommandBuffer &buffer)
+    {
+        std::vector<const DrawCall *> draws;
+        for (const DrawCall &draw : buffer.draws)
+        {
+            draws.push_back(&draw);
+        }
+        if (capture)
+            capture->submit(draws);
+        execute(draws);
+    }
 
-        // vertex shaders
-        for (int v = 0; v < vertex_count; v++)
+    void Rasterizer::submit(const std::vector<CommandBuffer> &buffers)
+    {
+        std::vector<const DrawCall *> draws;
+        for (const CommandBuffer &buffer : buffers)
         {
-            for (int i = 0; i < object.attributeValues.size(); i++)
+            for (const DrawCall &draw : buffer.draws)
             {
-                vertex_in_attrs[v].set<glm::vec4>(i, getAttribs(object, i, v, object.attributeDims[i]));
+                draws.push_back(&draw);
             }
-            vertex_pos[v] = shader_program->vs(shader_program->uniforms, vertex_in_attrs[v], vertex_out_attrs[v]);
         }
+        if (capture)
+            capture->submit(draws);
+        execute(draws);
+    }
 
-        rtp->set_render_function(rasterize_block);
+    // Runs a batch of draws in three parallel passes: vertex shading for
+    // every draw, binning every triangle into screen tiles (in draw order),
+    // and rasterizing the tiles. Draws are never reordered, and each tile is
+    // rasterized by a single thread in bin order, so fragments land in
+    // submission order per pixel and depth ties resolve the same every run.
+    void Rasterizer::execute(std::vector<const DrawCall *> &draws)
+    {
+        draws.erase(std::remove_if(draws.begin(), draws.end(),
+                                   [](const DrawCall *d) {
+                                       return d->program == nullptr || d->object->attributeValues.empty() ||
+                                              d->object->indices.empty();
+                                   }),
+                    draws.end());
+        if (draws.empty())
+            return;
 
-        auto render_triangle = [&](glm::ivec3 &idxs) {
-            glm::vec4 hom_tri[3] = {vertex_pos[idxs[0]], vertex_pos[idxs[1]], vertex_pos[idxs[2]]};
-            glm::vec3 tri[3] = {flatten(hom_tri[0]), flatten(hom_tri[1]), flatten(hom_tri[2])};
+        int h = framebuffer->h;
+        int w = framebuffer->w;
 
-            float xmin = fminf(tri[0].x, fminf(tri[1].x, tri[2].x)), ymin = fminf(tri[0].y, fminf(tri[1].y, tri[2].y));
-            float xmax = fmaxf(tri[0].x, fmaxf(tri[1].x, tri[2].x)), ymax = fmaxf(tri[0].y, fmaxf(tri[1].y, tri[2].y));
+        // vertex shaders, all draws in one pass
+        std::vector<int> vertex_base(draws.size() + 1, 0);
+        for (int d = 0; d < draws.size(); d++)
+        {
+            const Object &object = *draws[d]->object;
+            vertex_base[d + 1] = vertex_base[d] + object.attributeValues[0].size() / object.attributeDims[0];
+        }
+        std::vector<Attribs> vertex_out_attrs(vertex_base.back());
+        std::vector<glm::vec4> vertex_pos(vertex_base.back());
 
-            glm::ivec2 tl = pt2pix(xmin - p.x, ymin - p.y, p);
-            glm::ivec2 br = pt2pix(xmax + p.x, ymax + p.y, p);
+        const int vs_chunk = 256;
+        std::vector<glm::ivec2> vs_jobs; // (draw, first vertex)
+        for (int d = 0; d < draws.size(); d++)
+        {
+            for (int v = vertex_base[d]; v < vertex_base[d + 1]; v += vs_chunk)
+            {
+                vs_jobs.push_back(glm::ivec2(d, v));
+            }
+        }
+        rtp->parallelFor(vs_jobs.size(), [&](int tid, int job) {
+            int d = vs_jobs[job].x;
+            const DrawCall &draw = *draws[d];
+            const Object &object = *draw.object;
+            for (int v = vs_jobs[job].y; v < std::min(vs_jobs[job].y + vs_chunk, vertex_base[d + 1]); v++)
+            {
+                Attribs vertex_in_attrs;
+                for (int i = 0; i < object.attributeValues.size(); i++)
+                {
+                    vertex_in_attrs.set<glm::vec4>(
+                        i, getAttribs(object, i, v - vertex_base[d], object.attributeDims[i]));
+                }
+                vertex_pos[v] = draw.program->vs(draw.uniforms, vertex_in_attrs, vertex_out_attrs[v]);
+            }
+        });
+
+        // bin triangles of all draws into tiles
+        if (binner.beginBatch())
+            resetTiles(true);
+        std::vector<BatchTriangle> triangles;                // set up, by bin id
+        std::vector<VaryingPlane> varying_planes;            // of all triangles
+        std::vector<char> bin_writes(binner.tileCount(), 0); // has triangles other than proxies
+        long samples = 0;
+        void (*setup_depth_plane)(BatchTriangle &, const glm::vec4(&)[3], const float(&)[3]) =
+            depth_format == Core::DepthFormat::Float32Reversed ? setup_depth<Core::DepthFormat::Float32Reversed>
+            : depth_format == Core::DepthFormat::Unorm16       ? setup_depth<Core::DepthFormat::Unorm16>
+                                                               : setup_depth<Core::DepthFormat::Float32>;
+
+        for (int d = 0; d < draws.size(); d++)
+        {
+            for (const glm::ivec3 &idxs : draws[d]->object->indices)
+            {
+                glm::ivec3 v = idxs + vertex_base[d];
+                if (draws[d]->proxy &&
+                    (vertex_pos[v[0]].w <= 0 || vertex_pos[v[1]].w <= 0 || vertex_pos[v[2]].w <= 0))
+                {
+                    // reaches behind the eye, can't be bounded on screen: assume it's visible
+                    samples++;
+                    continue;
+                }
+                glm::vec4 hom[3] = {vertex_pos[v[0]], vertex_pos[v[1]], vertex_pos[v[2]]};
+                glm::vec3 ndc[3] = {flatten(hom[0]), flatten(hom[1]), flatten(hom[2])};
+                BatchTriangle tri;
+                tri.setup = Core::setupTriangle(ndc, w, h);
+                Core::TileRange range = binner.add(triangles.size(), tri.setup);
+                if (range.empty())
+                    continue;
+                float inv_w[3] = {1 / hom[0].w, 1 / hom[1].w, 1 / hom[2].w};
+                tri.inv_w = tri.setup.interpolate(inv_w[0], inv_w[1], inv_w[2]);
+                setup_depth_plane(tri, hom, inv_w);
+                tri.v = glm::ivec4(d, v);
+                tri.varyings = varying_planes.size();
+                tri.n_varyings = draws[d]->proxy ? 0 : vertex_out_attrs[v[0]].size();
+                for (int i = 0; i < tri.n_varyings; i++)
+                {
+                    // assuming vec4 here.
+                    glm::vec4 a[3] = {vertex_out_attrs[v[0]].get<glm::vec4>(i) * inv_w[0],
+                                      vertex_out_attrs[v[1]].get<glm::vec4>(i) * inv_w[1],
+                                      vertex_out_attrs[v[2]].get<glm::vec4>(i) * inv_w[2]};
+                    varying_planes.push_back(varying_plane(tri.setup, a));
+                }
+                triangles.push_back(tri);
+                for (int i = range.y0; i <= range.y1; i++)
+                {
+                    for (int j = range.x0; j <= range.x1; j++)
+                    {
+                        bin_writes[i * tiles_x + j] |= !draws[d]->proxy;
+                    }
+                }
+            }
+        }
 
-            int cw = 16, ch = 16; // divisible by total dim
+        for (int t : binner.tiles())
+        {
+            if (!bin_writes[t])
+                continue;
+            tile_dirty[t] = 1;
+            tile_cleared[t] = 0;
+            tile_depth[t] |= depth_enabled;
+            tile_hiz_stale[t] |= depth_enabled;
+        }
 
-            Attribs attrs[3] = {vertex_out_attrs[idxs[0]], vertex_out_attrs[idxs[1]], vertex_out_attrs[idxs[2]]};
+        switch (depth_format)
+        {
+        case Core::DepthFormat::Float32:
+            samples += rasterizeTiles<Core::DepthFormat::Float32>(draws, triangles, varying_planes);
+            break;
+        case Core::DepthFormat::Float32Reversed:
+            samples += rasterizeTiles<Core::DepthFormat::Float32Reversed>(draws, triangles, varying_planes);
+            break;
+        case Core::DepthFormat::Unorm16:
+            samples += rasterizeTiles<Core::DepthFormat::Unorm16>(draws, triangles, varying_planes);
+            break;
+        }
+        if (query != nullptr)
+            query->samples += samples;
+        if (binner.endBatch())
+            resetTiles(true);
+    }
 
-            rtp->set_triangle_data(hom_tri, attrs);
+    // Rasterizes the binned triangles of the batch, tile by tile, with depth format F.
+    // Returns the samples that passed the depth test.
+    template <Core::DepthFormat F>
+    long Rasterizer::rasterizeTiles(const std::vector<const DrawCall *> &draws,
+                                    const std::vector<BatchTriangle> &triangles,
+                                    const std::vector<VaryingPlane> &varying_planes)
+    {
+        typedef Core::Depth<F> Depth;
+        typename Depth::Value *zb = depth_enabled ? (typename Depth::Value *)z_buffer.data() : nullptr;
+        std::atomic<long> samples(0), tests(0), written(0), scanned(0);
+        std::vector<std::vector<glm::vec4>> row_starts(rtp->size() + 1); // per thread, for rasterize_block
+        binner.render(*rtp, [&](int tid, int t, glm::ivec2 tl, glm::ivec2 br) {
+            long tile_samples = 0, tile_written = 0, tile_tests = 0, tile_scanned = 0;
+            for (int i : binner.bin(t))
+            {
+                const BatchTriangle &tri = triangles[i];
+                const DrawCall &draw = *draws[tri.v.x];
+                if (draw.proxy)
+                {
+                    // Hi-Z: skip the tile if the proxy's nearest point is behind everything in it
+                    if (zb != nullptr &&
+                        !Depth::passes(typename Depth::Value(tri.znear), tileFarDepth<F>(t, tile_scanned)))
+                        continue;
+                    tile_samples += rasterize_proxy_block<F>(framebuffer, zb, tile_tests, tri, tl, br);
+                    continue;
+                }
+                long block_samples = rasterize_block<F>(framebuffer, draw.program, draw.uniforms, zb, tile_tests, tri,
+                                                        varying_planes.data() + tri.varyings, tl, br, row_starts[tid]);
+                tile_samples += block_samples;
+                tile_written += block_samples;
+            }
+            samples += tile_samples;
+            tests += tile_tests;
+            written += tile_written;
+            scanned += tile_scanned;
+        });
+        depth_stats.tests += tests;
+        depth_stats.bytes_read += (tests + scanned) * sizeof(typename Depth::Value);
+        if (zb != nullptr)
+            depth_stats.bytes_written += written * sizeof(typename Depth::Value);
+        return samples;
+    }
 
-            // chunk this up and enqueue
-            for (int i = (tl.y / ch) * ch; i <= (br.y / ch) * ch; i += ch)
+    // The farthest depth in tile t, recomputed only if the tile's depth was written since.
+    // Only called from the job rasterizing the tile, so tiles don't race. Adds the samples
+    // it had to read to scanned.
+    template <Core::DepthFormat F> float Rasterizer::tileFarDepth(int t, long &scanned)
+    {
+        typedef Core::Depth<F> Depth;
+        if (tile_hiz_stale[t])
+        {
+            SDL_Rect rect = tileRect(t);
+            const typename Depth::Value *zb = (const typename Depth::Value *)z_buffer.data();
+            typename Depth::Value farthest = zb[rect.y * framebuffer->w + rect.x];
+            for (int i = rect.y; i < rect.y + rect.h; i++)
             {
-                for (int j = (tl.x / cw) * cw; j <= (br.x / cw) * cw; j += cw)
+                const typename Depth::Value *row = zb + i * framebuffer->w + rect.x;
+                for (int j = 0; j < rect.w; j++)
                 {
-                    rtp->enqueue(glm::ivec2(j, i), glm::ivec2(j + cw - 1, i + cw - 1));
+                    if (Depth::passes(farthest, row[j]))
+                        farthest = row[j];
                 }
             }
-            // std::cout << "Starting rendering via multithreading" << std::endl;
-            rtp->run();
-        };
+            scanned += long(rect.w) * rect.h;
+            tile_hiz[t] = farthest;
+            tile_hiz_stale[t] = 0;
+        }
+        return tile_hiz[t];
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    /// Command buffers
+    ////////////////////////////////////////////////////////////////////////////
+
+    void CommandBuffer::useShaderProgram(const ShaderProgram &program)
+    {
+        this->program = &program;
+    }
+
+    void CommandBuffer::drawObject(const Object &object)
+    {
+        if (program == nullptr)
+        {
+            std::cout << "Warning: drawObject recorded without a shader program, ignoring" << std::endl;
+            return;
+        }
+        auto it = uniforms.find(program);
+        draws.push_back({program, it != uniforms.end() ? it->second : program->uniforms, &object, false});
+    }
 
-        // render_triangle(object.indices[0]);
-        for (glm::ivec3 idxs : object.indices)
+    void CommandBuffer::reset()
+    {
+        draws.clear();
+        program = nullptr;
+        uniforms.clear();
+    }
+
+    template <typename T> void setBufferUniform(std::map<const ShaderProgram *, Uniforms> &uniforms,
+                                                ShaderProgram &sp, const std::string &name, T value)
+    {
+        auto it = uniforms.find(&sp);
+        if (it == uniforms.end())
         {
-            render_triangle(idxs);
+            it = uniforms.insert({&sp, sp.uniforms}).first;
         }
+        it->second.set<T>(name, value);
+    }
 
-        // rtp->stop();
+    // clang-format off
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, float     value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, int       value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec2 value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat2 value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec3 value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat3 value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, glm::vec4 value) { setBufferUniform(uniforms, sp, name, value); }
+    template <> void CommandBuffer::setUniform(ShaderProgram &sp, const std::string &name, glm::mat4 value) { setBufferUniform(uniforms, sp, name, value); }
+    // clang-format on
+
+    // Merges the window rects of the given tiles (sorted by index) into fewer, larger rects:
+    // runs of tiles along a row, then runs stacked on identical runs of the row above.
+    static std::vector<SDL_Rect> mergeTileRects(const std::vector<int> &tiles, int tiles_x,
+                                                std::function<SDL_Rect(int)> rect_of)
+    {
+        std::vector<SDL_Rect> rects;
+        int row_begin = 0, row = -1;
+        for (int k = 0; k < tiles.size(); k++)
+        {
+            int t = tiles[k];
+            if (t / tiles_x != row)
+            {
+                row_begin = rects.size();
+                row = t / tiles_x;
+            }
+            SDL_Rect r = rect_of(t);
+            if (rects.size() > row_begin && tiles[k - 1] == t - 1)
+            {
+                rects.back().w += r.w;
+                continue;
+            }
+            rects.push_back(r);
+        }
+        // tile rows go bottom-up, so a run sits right above the one it extends
+        std::vector<SDL_Rect> merged;
+        for (const SDL_Rect &r : rects)
+        {
+            bool extended = false;
+            for (SDL_Rect &m : merged)
+            {
+                if (m.x == r.x && m.w == r.w && r.y + r.h == m.y)
+                {
+                    m.y = r.y;
+                    m.h += r.h;
+                    extended = true;
+                    break;
+                }
+            }
+            if (!extended)
+                merged.push_back(r);
+        }
+        return merged;
     }
 
     // Displays the framebuffer on the screen.
-    // This can probably be optimized/parallelized but it works for now
-    // Use a dirty bit buffer to mark bits that have been updated?
+    // Only the tiles touched by clear() or a draw since the last show() are
+    // resolved, converted and presented.
     void Rasterizer::show()
     {
-        auto windowSurface = SDL_GetWindowSurface(window);
-        int w = framebuffer->w;
-        int b = w / windowSurface->w;
-        if (b == 1)
+        if (capture)
         {
-            SDL_BlitSurface(framebuffer, NULL, windowSurface, NULL);
-            SDL_UpdateWindowSurface(window);
-            return;
+            capture->show();
+            if (capture->frames() == capture_frames)
+                endCapture();
+        }
+        auto windowSurface = getDisplaySurface();
+        if (windowSurface != presented)
+        {
+            // new (or recreated) window surface, nothing on it is up to date
+            std::fill(tile_dirty.begin(), tile_dirty.end(), 1);
+            presented = windowSurface;
         }
-        int buf, avg[3];
-        Uint8 px[3];
-        for (int i = 0; i < windowSurface->h; i++)
+        std::vector<int> dirty;
+        for (int t = 0; t < tile_dirty.size(); t++)
         {
-            for (int j = 0; j < windowSurface->w; j++)
+            if (tile_dirty[t])
+                dirty.push_back(t);
+            tile_dirty[t] = 0;
+        }
+        if (dirty.empty())
+            return;
+
+        int w = framebuffer->w;
+        int b = w / windowSurface->w;
+        auto window_rect = [&](int t) {
+            SDL_Rect r = tileRect(t);
+            return SDL_Rect{r.x / b, r.y / b, r.w / b, r.h / b};
+        };
+        std::vector<SDL_Rect> rects = mergeTileRects(dirty, tiles_x, window_rect);
+
+        // resolve samples and convert to the window's format, one tile per job
+        SDL_PixelFormat *format = windowSurface->format;
+        bool native = format->BytesPerPixel == 4 && format->Rmask == 0x00FF0000 && format->Gmask == 0x0000FF00 &&
+                      format->Bmask == 0x000000FF;
+        rtp->parallelFor(dirty.size(), [&](int tid, int job) {
+            SDL_Rect rect = window_rect(dirty[job]);
+            for (int i = rect.y; i < rect.y + rect.h; i++)
             {
-                avg[0] = avg[1] = avg[2] = 0;
-                for (int k = 0; k < b; k++)
+                const Uint32 *src = (Uint32 *)framebuffer->pixels + w * i * b;
+                Uint8 *dst = (Uint8 *)windowSurface->pixels + windowSurface->pitch * i;
+                for (int j = rect.x; j < rect.x + rect.w; j++)
                 {
-                    for (int l = 0; l < b; l++)
+                    Uint32 px;
+                    if (b == 1)
+                    {
+                        px = src[j];
+                    }
+                    else
                     {
-                        buf = ((Uint32 *)framebuffer->pixels)[w * (i * b + k) + j * b + l];
-                        SDL_GetRGB(buf, framebuffer->format, px, (px + 1), (px + 2));
-                        avg[0] += px[0];
-                        avg[1] += px[1];
-                        avg[2] += px[2];
+                        // box filter over the b x b samples of this pixel
+                        int avg[3] = {0, 0, 0};
+                        for (int k = 0; k < b; k++)
+                        {
+                            for (int l = 0; l < b; l++)
+                            {
+                                Uint32 sample = src[w * k + j * b + l];
+                                avg[0] += (sample >> 16) & 0xFF;
+                                avg[1] += (sample >> 8) & 0xFF;
+                                avg[2] += sample & 0xFF;
+                            }
+                        }
+                        px = (avg[0] / (b * b)) << 16 | (avg[1] / (b * b)) << 8 | avg[2] / (b * b);
+                    }
+                    if (native)
+                    {
+                        ((Uint32 *)dst)[j] = (px & 0x00FFFFFF) | format->Amask;
+                    }
+                    else
+                    {
+                        Uint32 mapped = SDL_MapRGB(format, (px >> 16) & 0xFF, (px >> 8) & 0xFF, px & 0xFF);
+                        memcpy(dst + j * format->BytesPerPixel, &mapped, format->BytesPerPixel);
                     }
                 }
-                avg[0] /= b * b;
-                avg[1] /= b * b;
-                avg[2] /= b * b;
-                ((Uint32 *)windowSurface->pixels)[windowSurface->w * i + j] =
-                    SDL_MapRGB(windowSurface->format, avg[0], avg[1], avg[2]);
             }
+        });
+        if (terminal)
+        {
+            // straight from the samples, the terminal's box filter resolves them
+            terminal->present((Uint32 *)framebuffer->pixels, w, framebuffer->h, framebuffer->pitch / 4, 16, 8, 0);
         }
-        // SDL_BlitScaled(framebuffer, NULL, windowSurface, NULL);
-        SDL_UpdateWindowSurface(window);
+        if (window == nullptr)
+            return;
+        if (dirty.size() == tile_dirty.size())
+            SDL_UpdateWindowSurface(window);
+        else
+            SDL_UpdateWindowSurfaceRects(window, rects.data(), rects.size());
     }
 
 } // namespace Software
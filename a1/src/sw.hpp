@@ -8,6 +8,11 @@
 #include <vector>
 #include <thread>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include "../../core/depth.hpp"
+#include "../../core/raster.hpp"
+#include "../../core/terminal.hpp"
 
 namespace COL781
 {
@@ -21,7 +26,7 @@ namespace Software
         // only float, glm::vec2, glm::vec3, glm::vec4 allowed
         template <typename T> T get(int attribIndex) const;
         template <typename T> void set(int attribIndex, T value);
-        int size();
+        int size() const;
 
       private:
         std::vector<glm::vec4> values;
@@ -31,25 +36,33 @@ namespace Software
     class Uniforms
     {
         // A class to contain all the uniform variables
+        // Values are shared between copies and replaced (never mutated) on set,
+        // so a copy is a cheap snapshot of the current uniform state.
       public:
         // any type allowed
         template <typename T> T get(const std::string &name) const
         {
-            return *(T *)values.at(name);
+            return *(T *)values.at(name).data.get();
         }
 
         template <typename T> void set(const std::string &name, T value)
         {
-            auto it = values.find(name);
-            if (it != values.end())
-            {
-                delete it->second;
-            }
-            values[name] = (void *)(new T(value));
+            values[name] = {std::shared_ptr<void>(new T(value), [](void *p) { delete (T *)p; }), sizeof(T)};
         }
 
+        // Untyped access to the stored bytes, used to save and restore uniforms.
+        // Only meaningful for trivially copyable types (which all the allowed ones are).
+        void setRaw(const std::string &name, const void *data, size_t size);
+        std::vector<std::string> names() const;
+        const void *getRaw(const std::string &name, size_t &size) const;
+
       private:
-        std::map<std::string, void *> values;
+        struct Value
+        {
+            std::shared_ptr<void> data;
+            size_t size;
+        };
+        std::map<std::string, Value> values;
     };
 
     /* A vertex shader is a function that:
@@ -63,11 +76,16 @@ namespace Software
        and returns the colour of the fragment as an RGBA value. */
     using FragmentShader = glm::vec4 (*)(const Uniforms &uniforms, const Attribs &in);
 
+    // A new process-wide id. Captures tell programs and objects apart by it rather than by
+    // address, which a new one may reuse once an old one goes out of scope.
+    int newCaptureId();
+
     struct ShaderProgram
     {
         VertexShader vs;
         FragmentShader fs;
         Uniforms uniforms;
+        int capture_id = newCaptureId(); // shared by copies, which capture as the same program
     };
 
     struct Object
@@ -76,64 +94,192 @@ namespace Software
         std::vector<Buffer> attributeValues;
         std::vector<int> attributeDims;
         std::vector<glm::ivec3> indices;
+        int capture_id = newCaptureId(); // shared by copies, which capture as the same object
     };
 
-    class RasterizerThreadPool;
+    // A draw call together with the program state it was recorded with.
+    struct DrawCall
+    {
+        const ShaderProgram *program;
+        Uniforms uniforms;
+        const Object *object;
+        bool proxy; // depth-only conservative test, see Rasterizer::drawProxy
+    };
+
+    // The number of samples that passed the depth test between
+    // Rasterizer::beginQuery and Rasterizer::endQuery.
+    struct OcclusionQuery
+    {
+        long samples = 0;
+    };
+
+    // Bytes of depth buffer the rasterizer has read and written, in whatever
+    // format the buffer was in at the time.
+    struct DepthStats
+    {
+        long tests = 0;         // depth tests, of samples and proxies
+        long bytes_read = 0;    // by depth tests and Hi-Z
+        long bytes_written = 0; // by samples passing the depth test, and clears
+    };
+
+    /* A command buffer records state changes and draw calls without executing
+       them. Buffers don't share any state, so several threads can each record
+       into their own buffer at the same time and the buffers can then be
+       submitted together with Rasterizer::submit.
+       Uniforms set on a buffer only apply to draws recorded later in that
+       buffer; the program itself is left unchanged. */
+    class CommandBuffer
+    {
+      public:
+        void useShaderProgram(const ShaderProgram &program);
+        // T is only allowed to be float, int, glm::vec2/3/4, glm::mat2/3/4.
+        template <typename T> void setUniform(ShaderProgram &program, const std::string &name, T value);
+        void drawObject(const Object &object);
+        // Discards all recorded commands so the buffer can be reused for the next frame.
+        void reset();
+
+      private:
+        friend class Rasterizer;
+        friend class Capture;
+        friend class Replay;
+
+        std::vector<DrawCall> draws;
+        const ShaderProgram *program = nullptr;
+        std::map<const ShaderProgram *, Uniforms> uniforms;
+    };
+
+    class Capture;
+    struct BatchTriangle;
+    struct VaryingPlane;
 
     class Rasterizer {
         public:
 #include "api.inc"
+
+            /** Command buffers (software only) **/
+
+            // Executes the draws recorded in the given command buffer(s), in the order they were recorded.
+            void submit(const CommandBuffer &buffer);
+            void submit(const std::vector<CommandBuffer> &buffers);
+
+            /** Headless rendering, capture and replay (software only) **/
+
+            // Like initialize, but show() presents into an offscreen surface instead of a window.
+            bool initializeHeadless(int width, int height, int spp = 1);
+
+            // The surface that show() presents into (the window surface, or the offscreen one).
+            SDL_Surface *getDisplaySurface();
+
+            // Names a custom shader so that captures can refer to it. Replaying a capture
+            // needs the same names registered. Built-in shaders are always known.
+            void registerShader(const std::string &name, VertexShader vs);
+            void registerShader(const std::string &name, FragmentShader fs);
+
+            // Adds the built-in shaders under the names of the methods that return them.
+            static void builtinShaders(std::map<std::string, VertexShader> &vs,
+                                       std::map<std::string, FragmentShader> &fs);
+
+            // Records every API call made on this rasterizer to a binary file, to be re-executed
+            // later with Replay. Setting COL781_CAPTURE=<path> starts a capture in initialize,
+            // and COL781_CAPTURE_FRAMES=<n> ends it after n frames.
+            bool beginCapture(const std::string &path);
+            void endCapture();
+
+            /** Terminal output (software only) **/
+
+            // Also shows every frame in the terminal, as truecolor half blocks redrawn only where they
+            // changed, e.g. to watch a headless render over ssh. A size of 0 follows the image's aspect
+            // ratio. Setting COL781_TERMINAL=<columns> or <columns>x<rows> starts it in initialize
+            // and initializeHeadless.
+            void beginTerminalOutput(int columns = 0, int rows = 0);
+            void endTerminalOutput();
+
+            // Restores the terminal if it was showing frames and ends a capture still recording.
+            ~Rasterizer();
+
+            // Not copyable: it owns its capture and terminal display.
+            Rasterizer() = default;
+            Rasterizer(const Rasterizer &) = delete;
+            Rasterizer &operator=(const Rasterizer &) = delete;
+
+            /** Occlusion queries (software only) **/
+
+            // Counts the samples of all draws (and proxies) that pass the depth test until endQuery.
+            // Queries don't nest. Drawing is synchronous, so the count is final once endQuery returns.
+            void beginQuery(OcclusionQuery &query);
+            void endQuery();
+
+            // Tests the triangles of the object, placed by the active program's vertex shader, against
+            // the depth buffer without writing color or depth. Coverage and depth are conservative
+            // (a pixel counts if the triangle touches it and its nearest point passes), so a query
+            // around proxies that ends with 0 samples means the real object would be hidden.
+            // Overlapping proxy triangles each count the samples they cover.
+            void drawProxy(const Object &object);
+
+            /** Depth buffer format (software only) **/
+
+            // How depth is stored: Float32 (the default), Float32Reversed for precision far from the
+            // camera, or Unorm16 for half the memory traffic. Float32Reversed needs a reversed-Z
+            // projection such as Core::reversedPerspective. Changing it clears the depth buffer.
+            void setDepthFormat(Core::DepthFormat format);
+            Core::DepthFormat getDepthFormat() const;
+
+            /** Statistics (software only) **/
+
+            // The tile size in use, and how it was picked. It adapts to the sizes of the triangles drawn.
+            const Core::TilingStats &getTilingStats() const;
+
+            // Depth buffer traffic so far.
+            const DepthStats &getDepthStats() const;
+
         private:
-            SDL_Window* window;
-            bool quit;
+            void execute(std::vector<const DrawCall *> &draws);
+            void createFramebuffer(int width, int height, int spp);
+            void resetTiles(bool retune);
+            SDL_Rect tileRect(int t) const;
+            template <Core::DepthFormat F>
+            long rasterizeTiles(const std::vector<const DrawCall *> &draws, const std::vector<BatchTriangle> &triangles,
+                                const std::vector<VaryingPlane> &varying_planes);
+            template <Core::DepthFormat F> float tileFarDepth(int t, long &scanned);
+            void allocateDepth();
+            void fillDepth(const SDL_Rect &rect);
+            float depthClearValue() const;
+
+            SDL_Window* window = nullptr;
+            SDL_Surface *offscreen = nullptr;
+            bool quit = false;
 
             int spp = 1;
-            SDL_Surface *framebuffer;
-            const ShaderProgram* shader_program;
+            SDL_Surface *framebuffer = nullptr;
+            const ShaderProgram* shader_program = nullptr;
 
-            RasterizerThreadPool *rtp;
+            Core::ThreadPool *rtp = nullptr;
 
             bool depth_enabled = false;
-            float *z_buffer;
-    };
+            Core::DepthFormat depth_format = Core::DepthFormat::Float32;
+            std::vector<char> z_buffer; // of depth_format values, rows top-down like the framebuffer
+            DepthStats depth_stats;
 
-    class RasterizerThreadPool
-    {
-      public:
-        RasterizerThreadPool(size_t n_threads);
-        ~RasterizerThreadPool();
-        void run();
-        void start();
-        void stop();
-        void enqueue(glm::ivec2 tl, glm::ivec2 br);
-        void set_render_function(
-            std::function<void(int,                                           // thread index
-                               SDL_Surface *, const ShaderProgram *, float *, // common buffers to write to
-                               glm::vec4 (&)[3], Attribs (&)[3],              // triangle-specific attributes
-                               glm::ivec2 &, glm::ivec2 &                     // top-left and bottom-right pixel bounds
-                               )>
-                fn);
-        void set_triangle_data(glm::vec4 (&tri)[3], Attribs (&attrs)[3]);
-
-        SDL_Surface **framebuffer;
-        const ShaderProgram **program;
-        float **z_buffer;
+            // The framebuffer is split into tiles of tile_size x tile_size pixels, picked by the binner's
+            // tuner. Draws are binned into them, and they track what changed since the last show().
+            Core::TileBinner binner;
+            int tile_size, tiles_x, tiles_y;
+            std::vector<char> tile_dirty;   // touched since the last show()
+            std::vector<char> tile_cleared; // holds nothing but clear_color
+            std::vector<char> tile_depth;   // depth written since the last clear()
+            std::vector<float> tile_hiz;    // farthest stored depth in the tile, if not stale
+            std::vector<char> tile_hiz_stale;
+            Uint32 clear_color = 0;
+            SDL_Surface *presented = nullptr; // surface the last show() went to
 
-      private:
-        void _thread_fn(int thread_idx);
-
-        size_t _n_threads;
-        std::vector<std::thread> _threads;
-        std::vector<std::vector<std::pair<glm::ivec2, glm::ivec2>>> _workqueues;
-        int _next_workq;
-        volatile bool _alive;
-        volatile bool _work[12]; // capping _work size but should be ok
-        std::function<void(int, SDL_Surface *, const ShaderProgram *, float *, glm::vec4 (&)[3], Attribs (&)[3],
-                           glm::ivec2 &, glm::ivec2 &)>
-            _fn;
-
-        glm::vec4 _tri[3];
-        Attribs _attrs[3];
+            OcclusionQuery *query = nullptr;
+
+            Capture *capture = nullptr;
+            int capture_frames = -1;
+
+            Core::TerminalDisplay *terminal = nullptr;
+
+            friend class Capture;
     };
 
 } // namespace Software
@@ -0,0 +1,233 @@
+#ifndef EDGE_MAP_HPP
+#define EDGE_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Maps directed edges (from, to) to the index of their half-edge.
+ *
+ * An open-addressing hash table with linear probing over one flat array, so a
+ * lookup is usually a single cache line and inserts don't allocate once the
+ * table is reserved. Erasing moves the later entries of a probe run back
+ * instead of leaving tombstones, so lookups stay short however many edges
+ * remeshing erases and re-inserts.
+ */
+class EdgeMap
+{
+  public:
+    struct Entry
+    {
+        uint64_t key; // (from << 32) | to
+        int he;
+    };
+
+    static uint64_t key(int from, int to)
+    {
+        return (uint64_t(from) << 32) | uint32_t(to);
+    }
+
+    // Makes room for n edges without growing.
+    void reserve(size_t n)
+    {
+        size_t capacity = 16;
+        while (capacity < 2 * n)
+        {
+            capacity *= 2;
+        }
+        if (capacity > slots.size())
+        {
+            rehash(capacity);
+        }
+    }
+
+    void clear()
+    {
+        slots.assign(slots.size(), Entry{empty, -1});
+        count = 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // The half-edge from -> to, or -1 if there is none.
+    int find(int from, int to) const
+    {
+        if (count == 0)
+        {
+            return -1;
+        }
+        uint64_t k = key(from, to);
+        for (size_t i = home(k);; i = (i + 1) & mask)
+        {
+            if (slots[i].key == k)
+            {
+                return slots[i].he;
+            }
+            if (slots[i].key == empty)
+            {
+                return -1;
+            }
+        }
+    }
+
+    // Adds the half-edge from -> to, or replaces it.
+    void set(int from, int to, int he)
+    {
+        if (2 * (count + 1) > slots.size())
+        {
+            rehash(slots.empty() ? 16 : 2 * slots.size());
+        }
+        uint64_t k = key(from, to);
+        size_t i = home(k);
+        while (slots[i].key != k && slots[i].key != empty)
+        {
+            i = (i + 1) & mask;
+        }
+        if (slots[i].key == empty)
+        {
+            count++;
+        }
+        slots[i] = Entry{k, he};
+    }
+
+    // Removes the half-edge from -> to, if there is one.
+    void erase(int from, int to)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        uint64_t k = key(from, to);
+        size_t i = home(k);
+        while (slots[i].key != k)
+        {
+            if (slots[i].key == empty)
+            {
+                return;
+            }
+            i = (i + 1) & mask;
+        }
+        // pull back every later entry of the run that may live in the hole
+        for (size_t j = (i + 1) & mask; slots[j].key != empty; j = (j + 1) & mask)
+        {
+            if (((j - home(slots[j].key)) & mask) >= ((j - i) & mask))
+            {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = Entry{empty, -1};
+        count--;
+    }
+
+    // The slots of the table, empty ones included, to store the table as is.
+    const std::vector<Entry> &table() const
+    {
+        return slots;
+    }
+
+    // Restores a table returned by table(), given its number of entries.
+    void assign(const Entry *table, size_t capacity, size_t entries)
+    {
+        slots.assign(table, table + capacity);
+        set_capacity(capacity);
+        count = entries;
+    }
+
+    // Visits the entries in no particular order.
+    class const_iterator
+    {
+      public:
+        const_iterator(const Entry *entry, const Entry *end) : entry(entry), end(end)
+        {
+            skip();
+        }
+        const Entry &operator*() const
+        {
+            return *entry;
+        }
+        const Entry *operator->() const
+        {
+            return entry;
+        }
+        const_iterator &operator++()
+        {
+            entry++;
+            skip();
+            return *this;
+        }
+        bool operator!=(const const_iterator &other) const
+        {
+            return entry != other.entry;
+        }
+
+      private:
+        void skip()
+        {
+            while (entry != end && entry->key == empty)
+            {
+                entry++;
+            }
+        }
+        const Entry *entry, *end;
+    };
+
+    const_iterator begin() const
+    {
+        return const_iterator(slots.data(), slots.data() + slots.size());
+    }
+    const_iterator end() const
+    {
+        return const_iterator(slots.data() + slots.size(), slots.data() + slots.size());
+    }
+
+  private:
+    static const uint64_t empty = ~uint64_t(0);
+
+    // Fibonacci hashing: the top bits of key * 2^64 / phi.
+    size_t home(uint64_t k) const
+    {
+        return size_t((k * 0x9E3779B97F4A7C15ull) >> shift);
+    }
+
+    // capacity is a power of two
+    void set_capacity(size_t capacity)
+    {
+        mask = capacity - 1;
+        shift = 64;
+        for (size_t c = capacity; c > 1; c /= 2)
+        {
+            shift--;
+        }
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Entry> old(capacity, Entry{empty, -1});
+        old.swap(slots);
+        set_capacity(capacity);
+        for (const Entry &entry : old)
+        {
+            if (entry.key == empty)
+            {
+                continue;
+            }
+            size_t i = home(entry.key);
+            while (slots[i].key != empty)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = entry;
+        }
+    }
+
+    std::vector<Entry> slots;
+    size_t mask = 0, count = 0;
+    int shift = 64;
+};
+
+#endif
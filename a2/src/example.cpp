@@ -16,10 +16,25 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
+    // example <mesh.obj | snapshot.hem> [snapshot to save]
     std::string path(argv[1]);
 
     HalfEdgeMesh mesh;
-    mesh.load_objfile(path);
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".hem") == 0)
+    {
+        if (!mesh.load_snapshot(path))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        mesh.load_objfile(path);
+    }
+    if (argc > 2)
+    {
+        mesh.save_snapshot(argv[2]);
+    }
 
     std::cout << "Loaded " << mesh.n_verts << " verts, " << mesh.n_tris << " triangles and " << mesh.n_he
               << " halfedges\n";
@@ -62,6 +77,9 @@ int main(int argc, char** argv)
     v.setVertices(mesh.n_verts, mesh.vert_pos.data());
     v.setNormals(mesh.n_verts, mesh.vert_normal.data());
     v.setTriangles(mesh.n_tris, mesh.tri_verts.data());
+    // the same vertices with a quarter of the triangles, as for a distant mesh:
+    // std::vector<HalfEdgeMesh::LevelOfDetail> lods = mesh.level_of_detail_chain();
+    // v.setTriangles(lods[1].tris.size(), lods[1].tris.data());
 
     v.view();
 }
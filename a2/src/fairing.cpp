@@ -0,0 +1,114 @@
+#include "mesh.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+// Benchmarks explicit against implicit smoothing: adds noise to a mesh, then
+// removes it with explicit Gaussian steps and with a single implicit step of
+// comparable strength, and reports the time taken and how smooth the result is.
+//
+//   fairing <mesh.obj> [explicit steps = 200] [lambda = 0.5] [noise = 0.2]
+//
+// noise is relative to the mean edge length, and the implicit step takes
+// t = steps * lambda * (mean edge length)^2 / 4, about what the explicit steps
+// amount to on an evenly sampled mesh.
+
+static float mean_edge_length(HalfEdgeMesh &mesh)
+{
+    double sum = 0;
+    for (int he = 0; he < mesh.n_he; he++)
+    {
+        sum += mesh.he_length(he);
+    }
+    return sum / mesh.n_he;
+}
+
+// Mean curvature, |K x| over the vertex's area, times the mean edge length: the
+// median over the vertices, since a few slivers can have any curvature at all.
+// It is about 0 where the mesh is locally flat.
+static float roughness(HalfEdgeMesh &mesh, float l)
+{
+    SparseMatrix K;
+    std::vector<float> mass;
+    mesh.cotangent_laplacian(K, mass);
+    std::vector<glm::vec3> Kx;
+    K.multiply(mesh.vert_pos, Kx);
+    std::vector<float> curvature;
+    for (int v = 0; v < mesh.n_verts; v++)
+    {
+        if (mass[v] > 0)
+        {
+            curvature.push_back(glm::length(Kx[v]) / mass[v] * l);
+        }
+    }
+    if (curvature.empty())
+    {
+        return 0;
+    }
+    std::nth_element(curvature.begin(), curvature.begin() + curvature.size() / 2, curvature.end());
+    return curvature[curvature.size() / 2];
+}
+
+// Mean distance moved from the original positions, over the mean edge length.
+static float displacement(const std::vector<glm::vec3> &from, const std::vector<glm::vec3> &to, float l)
+{
+    double sum = 0;
+    for (size_t v = 0; v < from.size(); v++)
+    {
+        sum += glm::length(to[v] - from[v]);
+    }
+    return sum / from.size() / l;
+}
+
+static double ms_since(std::chrono::steady_clock::time_point tic)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tic).count();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <mesh.obj> [explicit steps] [lambda] [noise]\n";
+        return EXIT_FAILURE;
+    }
+    std::string path(argv[1]);
+    int steps = argc > 2 ? atoi(argv[2]) : 200;
+    float lambda = argc > 3 ? atof(argv[3]) : 0.5f;
+    float noise = argc > 4 ? atof(argv[4]) : 0.2f;
+
+    HalfEdgeMesh mesh;
+    mesh.load_objfile(path);
+    std::cout << "Loaded " << mesh.n_verts << " verts, " << mesh.n_tris << " triangles\n";
+    float l = mean_edge_length(mesh);
+    std::vector<glm::vec3> original = mesh.vert_pos;
+    srand(1);
+    for (glm::vec3 &p : mesh.vert_pos)
+    {
+        glm::vec3 r(rand(), rand(), rand());
+        p += noise * l * (2.0f * r / float(RAND_MAX) - 1.0f);
+    }
+    mesh.positions_changed();
+    std::vector<glm::vec3> noisy = mesh.vert_pos;
+    std::cout << "noisy:    roughness " << roughness(mesh, l) << ", off by " << displacement(original, noisy, l)
+              << " edges\n";
+
+    auto tic = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+        mesh.gaussian_smoothing(lambda);
+    }
+    double ms = ms_since(tic);
+    std::cout << "explicit: " << steps << " steps in " << ms << " ms, roughness " << roughness(mesh, l)
+              << ", off by " << displacement(original, mesh.vert_pos, l) << " edges\n";
+
+    mesh.vert_pos = noisy;
+    mesh.positions_changed();
+    float t = steps * lambda * l * l / 4;
+    tic = std::chrono::steady_clock::now();
+    int iterations = mesh.implicit_smoothing(t);
+    ms = ms_since(tic);
+    std::cout << "implicit: 1 step (" << iterations << " solver iterations) in " << ms << " ms, roughness "
+              << roughness(mesh, l) << ", off by " << displacement(original, mesh.vert_pos, l) << " edges\n";
+}
@@ -3,12 +3,62 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <climits>
+#include <functional>
+#include <queue>
 #include <unordered_set>
 #include "glm/glm.hpp"
 
 #include "mesh.hpp"
+#include "parallel.hpp"
 
-#define edge(from, to) ((uint64_t((from)) << 32) | (to))
+// A half-edge keyed by its undirected edge, (min vertex << bits) | max vertex.
+struct EdgeRecord
+{
+    uint64_t key;
+    int he;
+};
+
+// Sorts records by the low key_bits bits of their keys, keeping equal keys in order:
+// a least significant digit radix sort, each pass counted and scattered in parallel.
+static void radix_sort(std::vector<EdgeRecord> &records, int key_bits)
+{
+    const int digit_bits = 11, digits = 1 << digit_bits;
+    long n = records.size();
+    int chunks = chunk_count(n);
+    std::vector<EdgeRecord> sorted(n);
+    std::vector<long> offsets(chunks * digits);
+    for (int shift = 0; shift < key_bits; shift += digit_bits)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_chunks(n, [&](int c, long begin, long end) {
+            long *count = &offsets[c * digits];
+            for (long i = begin; i < end; i++)
+            {
+                count[(records[i].key >> shift) & (digits - 1)]++;
+            }
+        });
+        // where each chunk's records of each digit go: by digit, then by chunk
+        long sum = 0;
+        for (int d = 0; d < digits; d++)
+        {
+            for (int c = 0; c < chunks; c++)
+            {
+                long count = offsets[c * digits + d];
+                offsets[c * digits + d] = sum;
+                sum += count;
+            }
+        }
+        parallel_chunks(n, [&](int c, long begin, long end) {
+            long *next = &offsets[c * digits];
+            for (long i = begin; i < end; i++)
+            {
+                sorted[next[(records[i].key >> shift) & (digits - 1)]++] = records[i];
+            }
+        });
+        records.swap(sorted);
+    }
+}
 
 void HalfEdgeMesh::load_objfile(std::string &filename)
 {
@@ -19,6 +69,7 @@ void HalfEdgeMesh::load_objfile(std::string &filename)
         std::cerr << "Unable to open file: " << filename << '\n';
     }
     std::string line;
+    std::vector<glm::ivec3> faces;
     while (getline(objFile, line))
     {
         if (line.size() == 0)
@@ -55,14 +106,12 @@ void HalfEdgeMesh::load_objfile(std::string &filename)
             n -= 1; // TODO what if normal verts are not the same.
                     // Have a map for this as well
             // assuming all the triangles are counter-clockwise
-
-            // add half-edges
-            add_face(v);
+            faces.push_back(v);
         }
     }
     objFile.close();
-    // giving dummy he pairs to boundary hes
-    set_boundary();
+    // add half-edges, once the number of faces is known
+    set_faces(faces);
 }
 
 std::vector<int> HalfEdgeMesh::get_adjacent_vertices(int vertex)
@@ -80,22 +129,75 @@ std::vector<int> HalfEdgeMesh::get_adjacent_vertices(int vertex)
     return vertices;
 }
 
-void HalfEdgeMesh::gaussian_smoothing(float lambda)
+const HalfEdgeMesh::OneRing &HalfEdgeMesh::one_ring()
 {
-
-    std::vector<glm::vec3> vert_pos_new(vert_pos.size());
-    for (int v = 0; v < n_verts; v++)
+    if (ring.version == topology_version && ring.offsets.size() == n_verts + 1)
     {
-        std::vector<int> nbd = get_adjacent_vertices(v);
-        glm::vec3 delta(.0f, .0f, .0f);
-        for (int i = 0; i < nbd.size(); i++)
+        return ring;
+    }
+    // count every vertex's neighbours, then walk the rings again to list them
+    ring.offsets.assign(n_verts + 1, 0);
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long v = begin; v < end; v++)
         {
-            delta += (vert_pos[nbd[i]] - vert_pos[v]);
+            int he = vert_he[v], count = 0;
+            if (he != -1)
+            {
+                do
+                {
+                    count++;
+                    he = he_next[he_pair[he]];
+                } while (he != vert_he[v]);
+            }
+            ring.offsets[v + 1] = count;
         }
-        delta /= nbd.size();
-        vert_pos_new[v] = vert_pos[v] + lambda * delta;
+    });
+    for (int v = 0; v < n_verts; v++)
+    {
+        ring.offsets[v + 1] += ring.offsets[v];
     }
-    vert_pos = vert_pos_new;
+    ring.verts.resize(ring.offsets[n_verts]);
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long v = begin; v < end; v++)
+        {
+            int he = vert_he[v];
+            for (int i = ring.offsets[v]; i < ring.offsets[v + 1]; i++)
+            {
+                ring.verts[i] = he_vert[he_pair[he]];
+                he = he_next[he_pair[he]];
+            }
+        }
+    });
+    ring.version = topology_version;
+    return ring;
+}
+
+void HalfEdgeMesh::gaussian_smoothing(float lambda)
+{
+    // A Jacobi sweep: every vertex moves towards the average of its neighbours'
+    // old positions, so the vertices are independent and split across threads.
+    const OneRing &ring = one_ring();
+    vert_pos_back.resize(vert_pos.size());
+    const glm::vec3 *pos = vert_pos.data();
+    glm::vec3 *pos_new = vert_pos_back.data();
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long v = begin; v < end; v++)
+        {
+            int first = ring.offsets[v], last = ring.offsets[v + 1];
+            glm::vec3 delta(.0f, .0f, .0f);
+            for (int i = first; i < last; i++)
+            {
+                delta += (pos[ring.verts[i]] - pos[v]);
+            }
+            if (last > first)
+            {
+                delta /= float(last - first);
+            }
+            pos_new[v] = pos[v] + lambda * delta;
+        }
+    });
+    vert_pos.swap(vert_pos_back);
+    weights_stale = true;
 }
 
 void HalfEdgeMesh::taubin_smoothing(float lambda, float mu, int n_iter)
@@ -108,32 +210,295 @@ void HalfEdgeMesh::taubin_smoothing(float lambda, float mu, int n_iter)
     }
 }
 
-void HalfEdgeMesh::recompute_vertex_normals()
+// The cotangent of the angle at each corner of triangle (a, b, c), and the share
+// of the triangle in each corner's mixed Voronoi area (Meyer et al. 2003): the
+// Voronoi region if no angle is obtuse, else half the triangle to the obtuse
+// corner and a quarter to the others. Degenerate triangles get cotangents of 0.
+static void corner_weights(glm::vec3 a, glm::vec3 b, glm::vec3 c, float (&cot)[3], float (&area)[3])
+{
+    glm::vec3 p[3] = {a, b, c};
+    float twice_area = glm::length(glm::cross(b - a, c - a));
+    float d[3];
+    for (int k = 0; k < 3; k++)
+    {
+        d[k] = glm::dot(p[(k + 1) % 3] - p[k], p[(k + 2) % 3] - p[k]);
+        cot[k] = twice_area > 0 ? d[k] / twice_area : 0;
+    }
+    bool obtuse = d[0] < 0 || d[1] < 0 || d[2] < 0;
+    for (int k = 0; k < 3; k++)
+    {
+        if (!obtuse)
+        {
+            glm::vec3 e1 = p[(k + 1) % 3] - p[k], e2 = p[(k + 2) % 3] - p[k];
+            area[k] = (glm::dot(e1, e1) * cot[(k + 2) % 3] + glm::dot(e2, e2) * cot[(k + 1) % 3]) / 8;
+        }
+        else
+        {
+            area[k] = twice_area * (d[k] < 0 ? 0.25f : 0.125f);
+        }
+    }
+}
+
+void HalfEdgeMesh::update_triangle_weights(int tri)
 {
+    int he[3] = {tri_he[tri], he_next[tri_he[tri]], he_next[he_next[tri_he[tri]]]};
+    float cot[3], area[3];
+    corner_weights(vert_pos[he_vert[he[0]]], vert_pos[he_vert[he[1]]], vert_pos[he_vert[he[2]]], cot, area);
+    for (int k = 0; k < 3; k++)
+    {
+        he_cot[he[k]] = cot[(k + 2) % 3];
+        he_area[he[k]] = area[k];
+    }
+}
 
-    // Liu (1999)
-    // https://escholarship.org/content/qt7657d8h3/qt7657d8h3.pdf?t=ptt283
-    vert_normal.resize(vert_pos.size());
-    for (int q = 0; q < n_verts; q++)
+void HalfEdgeMesh::mark_moved(int vert)
+{
+    if (!weights_stale)
     {
-        std::vector<int> vertices = get_adjacent_vertices(q);
-        glm::vec3 normal(.0f, .0f, .0f);
-        for (int i = 0; i < vertices.size(); i++)
+        weights_dirty.push_back(vert);
+    }
+}
+
+void HalfEdgeMesh::positions_changed()
+{
+    weights_stale = true;
+}
+
+void HalfEdgeMesh::update_corner_weights()
+{
+    he_cot.resize(n_he, 0);
+    he_area.resize(n_he, 0);
+    // past a point, finding what changed costs more than redoing everything
+    if (weights_stale || weights_dirty.size() > n_verts / 16)
+    {
+        parallel_chunks(n_tris, [&](int c, long begin, long end) {
+            for (long tri = begin; tri < end; tri++)
+            {
+                if (tri_he[tri] != -1)
+                {
+                    update_triangle_weights(tri);
+                }
+            }
+        });
+    }
+    else
+    {
+        // the triangles around every vertex marked since the last update (and
+        // not deleted since), once each
+        std::vector<int> tris;
+        for (int v : weights_dirty)
         {
-            if (he_map.find((uint64_t(vertices[(i + 1) % vertices.size()]) << 32) | vertices[i]) != he_map.end())
+            if (vert_he[v] == -1)
+            {
+                continue;
+            }
+            int he = vert_he[v];
+            do
             {
-                int he = he_map[(uint64_t(vertices[(i + 1) % vertices.size()]) << 32) | vertices[i]];
-                int tri = he_tri[he];
-                if ((tri != -1) && (tri_verts[tri][0] == q || tri_verts[tri][1] == q || tri_verts[tri][2] == q))
+                if (he_tri[he] != -1)
                 {
-                    auto v1 = vert_pos[vertices[i]] - vert_pos[q];
-                    float mv1 = length(v1);
-                    auto v2 = vert_pos[vertices[(i + 1) % vertices.size()]] - vert_pos[q];
-                    float mv2 = length(v2);
-                    normal += glm::cross(v2, v1) / (mv1 * mv1 * mv2 * mv2);
+                    tris.push_back(he_tri[he]);
                 }
+                he = he_next[he_pair[he]];
+            } while (he != vert_he[v]);
+        }
+        std::sort(tris.begin(), tris.end());
+        tris.erase(std::unique(tris.begin(), tris.end()), tris.end());
+        for (int tri : tris)
+        {
+            update_triangle_weights(tri);
+        }
+    }
+    weights_stale = false;
+    weights_dirty.clear();
+}
+
+void HalfEdgeMesh::cotangent_laplacian(SparseMatrix &K, std::vector<float> &mass)
+{
+    update_corner_weights();
+
+    // row v: the diagonal, then the neighbours in one-ring order
+    const OneRing &ring = one_ring();
+    K.row_start.resize(n_verts + 1);
+    for (int v = 0; v <= n_verts; v++)
+    {
+        K.row_start[v] = ring.offsets[v] + v;
+    }
+    K.col.resize(K.row_start[n_verts]);
+    K.val.resize(K.row_start[n_verts]);
+    mass.resize(n_verts);
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long v = begin; v < end; v++)
+        {
+            int row = K.row_start[v], k = row + 1, he = vert_he[v];
+            float diag = 0, area = 0;
+            for (int i = ring.offsets[v]; i < ring.offsets[v + 1]; i++)
+            {
+                int pair = he_pair[he];
+                float w = ((he_tri[he] != -1 ? he_cot[he] : 0) + (he_tri[pair] != -1 ? he_cot[pair] : 0)) / 2;
+                K.col[k] = ring.verts[i];
+                K.val[k++] = -w;
+                diag += w;
+                area += he_tri[he] != -1 ? he_area[he] : 0;
+                he = he_next[he_pair[he]];
+            }
+            K.col[row] = v;
+            K.val[row] = diag;
+            mass[v] = area;
+        }
+    });
+}
+
+int HalfEdgeMesh::implicit_smoothing(float t, int max_iter, float tolerance)
+{
+    // Backward Euler on dx/dt = -M^-1 K x: (M + t K) x' = M x. The system is
+    // symmetric positive definite, and stable for any t.
+    SparseMatrix A;
+    std::vector<float> mass;
+    cotangent_laplacian(A, mass);
+    double mean_mass = 0;
+    for (float m : mass)
+    {
+        mean_mass += m;
+    }
+    mean_mass /= std::max(1, n_verts);
+    std::vector<glm::vec3> b(n_verts);
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long v = begin; v < end; v++)
+        {
+            // keeps vertices without any area (e.g. isolated ones) in place
+            float m = std::max(mass[v], float(1e-6 * mean_mass));
+            for (int k = A.row_start[v]; k < A.row_start[v + 1]; k++)
+            {
+                A.val[k] *= t;
+            }
+            A.val[A.row_start[v]] += m;
+            b[v] = m * vert_pos[v];
+        }
+    });
+    std::vector<glm::vec3> x(vert_pos.begin(), vert_pos.begin() + n_verts);
+    int iterations = solve_pcg(A, b, x, max_iter, tolerance);
+    std::copy(x.begin(), x.end(), vert_pos.begin());
+    weights_stale = true;
+    return iterations;
+}
+
+// The contributions of triangle (a, b, c), counter-clockwise, to the normals of
+// its three corners: its normal scaled by each corner's weight.
+static void corner_normals(NormalWeighting weighting, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 (&normals)[3])
+{
+    glm::vec3 e[3] = {b - a, c - b, a - c}; // edge k leaves corner k
+    glm::vec3 n = glm::cross(e[0], -e[2]);
+    for (int k = 0; k < 3; k++)
+    {
+        glm::vec3 out = e[k], in = -e[(k + 2) % 3];
+        if (weighting == NormalWeighting::Liu)
+        {
+            // Liu (1999)
+            // https://escholarship.org/content/qt7657d8h3/qt7657d8h3.pdf?t=ptt283
+            normals[k] = n / (glm::dot(out, out) * glm::dot(in, in));
+        }
+        else if (weighting == NormalWeighting::Angle)
+        {
+            float len = glm::length(n);
+            normals[k] = len > 0 ? n / len * std::atan2(len, glm::dot(out, in)) : n;
+        }
+        else
+        {
+            normals[k] = n; // twice the area
+        }
+    }
+}
+
+void HalfEdgeMesh::recompute_vertex_normals(NormalWeighting weighting)
+{
+    // Each triangle adds its normal to its corners. Threads take ranges of
+    // triangles, so they would race on shared vertices: all but the first
+    // add into their own copy of the normals, which are summed at the end.
+    vert_normal.assign(vert_pos.size(), glm::vec3(.0f, .0f, .0f));
+    int chunks = chunk_count(n_tris);
+    std::vector<std::vector<glm::vec3>> partial(chunks - 1);
+    parallel_chunks(n_tris, [&](int c, long begin, long end) {
+        if (c > 0)
+        {
+            partial[c - 1].assign(vert_pos.size(), glm::vec3(.0f, .0f, .0f));
+        }
+        glm::vec3 *normal = c > 0 ? partial[c - 1].data() : vert_normal.data();
+        for (long tri = begin; tri < end; tri++)
+        {
+            if (tri_he[tri] == -1)
+            {
+                continue;
+            }
+            glm::ivec3 v = tri_verts[tri];
+            glm::vec3 normals[3];
+            corner_normals(weighting, vert_pos[v[0]], vert_pos[v[1]], vert_pos[v[2]], normals);
+            for (int k = 0; k < 3; k++)
+            {
+                normal[v[k]] += normals[k];
+            }
+        }
+    });
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long q = begin; q < end; q++)
+        {
+            for (const std::vector<glm::vec3> &normal : partial)
+            {
+                vert_normal[q] += normal[q];
             }
+            vert_normal[q] = glm::normalize(vert_normal[q]);
+        }
+    });
+}
+
+void HalfEdgeMesh::update_vertex_normals(const std::vector<int> &moved, NormalWeighting weighting)
+{
+    // the moved vertices and their neighbours, once each
+    std::vector<int> verts;
+    std::vector<char> listed(n_verts, 0);
+    auto list = [&](int v) {
+        if (!listed[v])
+        {
+            listed[v] = 1;
+            verts.push_back(v);
+        }
+    };
+    for (int v : moved)
+    {
+        list(v);
+        int he = vert_he[v];
+        if (he == -1)
+        {
+            continue;
+        }
+        do
+        {
+            list(he_vert[he_pair[he]]);
+            he = he_next[he_pair[he]];
+        } while (he != vert_he[v]);
+    }
+    vert_normal.resize(vert_pos.size());
+    for (int q : verts)
+    {
+        // the triangles of the one-ring, each contributing its corner at q
+        glm::vec3 normal(.0f, .0f, .0f);
+        int he = vert_he[q];
+        if (he == -1)
+        {
+            continue;
         }
+        do
+        {
+            int tri = he_tri[he];
+            if (tri != -1)
+            {
+                glm::ivec3 v = tri_verts[tri];
+                glm::vec3 normals[3];
+                corner_normals(weighting, vert_pos[v[0]], vert_pos[v[1]], vert_pos[v[2]], normals);
+                normal += normals[v[0] == q ? 0 : v[1] == q ? 1 : 2];
+            }
+            he = he_next[he_pair[he]];
+        } while (he != vert_he[q]);
         vert_normal[q] = glm::normalize(normal);
     }
 }
@@ -144,12 +509,16 @@ void HalfEdgeMesh::set_vert_attribs(std::vector<glm::vec3> &vert_pos, std::vecto
     this->vert_pos = vert_pos;
     this->vert_normal = vert_normal;
     this->n_verts = vert_pos.size();
+    weights_stale = true;
+    free_verts.clear();
     this->vert_he.resize(n_verts, -1);
     this->vert_normal.resize(this->n_verts, glm::vec3(0, 0, 0));
 }
 
 void HalfEdgeMesh::add_face(glm::ivec3 &face)
 {
+    topology_version++;
+    weights_stale = true;
     int tri_idx = tri_he.size();
     int he_start_idx = he_next.size();
     tri_he.push_back(he_start_idx);
@@ -167,19 +536,20 @@ void HalfEdgeMesh::add_face(glm::ivec3 &face)
         he_next[he_idx] = he_start_idx + j;
         he_vert[he_idx] = v1;
         vert_he[v1] = he_idx;
-        uint64_t key = (uint64_t(v2) << 32) | v1;
-        if (he_map.find(key) != he_map.end())
+        int hep = he_map.find(v2, v1);
+        if (hep != -1)
         {
-            int hep = he_map[key];
             he_pair[he_idx] = hep;
             he_pair[hep] = he_idx;
         }
-        he_map[(uint64_t(v1) << 32) | v2] = he_idx;
+        he_map.set(v1, v2, he_idx);
     }
 }
 
 void HalfEdgeMesh::set_boundary()
 {
+    topology_version++;
+    weights_stale = true;
     // giving dummy he pairs to boundary hes
     n_he = he_vert.size();
     for (int i = 0; i < n_he; i++)
@@ -190,7 +560,7 @@ void HalfEdgeMesh::set_boundary()
             he_vert.push_back(v1);
             he_pair.push_back(i);
             he_pair[i] = he_vert.size() - 1;
-            he_map[(uint64_t(v1) << 32) | v2] = he_vert.size() - 1;
+            he_map.set(v1, v2, he_vert.size() - 1);
             he_tri.push_back(-1);
             he_next.push_back(-1);
             vert_he[v1] = he_vert.size() - 1;
@@ -207,11 +577,126 @@ void HalfEdgeMesh::set_boundary()
 
 void HalfEdgeMesh::set_faces(std::vector<glm::ivec3> &faces)
 {
-    for (auto &face : faces)
+    // Builds the connectivity in a few linear passes instead of a hash lookup per
+    // half-edge: the half-edges of face i are 3i, 3i + 1 and 3i + 2, sorting them by
+    // their undirected edge puts twins next to each other, and the boundary is then
+    // closed like set_boundary does. Any faces the mesh had are replaced; the result
+    // is the same as calling add_face for every face followed by set_boundary.
+    topology_version++;
+    weights_stale = true;
+    free_verts.clear();
+    free_he.clear();
+    free_tris.clear();
+    long n_faces = faces.size(), n_inner = 3 * n_faces;
+    tri_he.resize(n_faces);
+    tri_verts.resize(n_faces);
+    he_vert.resize(n_inner);
+    he_next.resize(n_inner);
+    he_pair.assign(n_inner, -1);
+    he_tri.resize(n_inner);
+    std::vector<int> max_vert(chunk_count(n_faces), -1);
+    parallel_chunks(n_faces, [&](int c, long begin, long end) {
+        for (long i = begin; i < end; i++)
+        {
+            tri_he[i] = 3 * i;
+            tri_verts[i] = faces[i];
+            for (int k = 0; k < 3; k++)
+            {
+                he_vert[3 * i + k] = faces[i][k];
+                he_next[3 * i + k] = 3 * i + (k + 1) % 3;
+                he_tri[3 * i + k] = i;
+                max_vert[c] = std::max(max_vert[c], faces[i][k]);
+            }
+        }
+    });
+    int n_vert_bits = 1;
+    while ((1L << n_vert_bits) <= *std::max_element(max_vert.begin(), max_vert.end()))
+    {
+        n_vert_bits++;
+    }
+
+    // pair twins
+    std::vector<EdgeRecord> records(n_inner);
+    parallel_chunks(n_inner, [&](int c, long begin, long end) {
+        for (long he = begin; he < end; he++)
+        {
+            uint64_t from = he_vert[he], to = he_vert[he_next[he]];
+            records[he].key = (std::min(from, to) << n_vert_bits) | std::max(from, to);
+            records[he].he = he;
+        }
+    });
+    radix_sort(records, 2 * n_vert_bits);
+    parallel_chunks(n_inner, [&](int c, long begin, long end) {
+        // the edges starting in this chunk
+        while (begin > 0 && begin < end && records[begin].key == records[begin - 1].key)
+        {
+            begin++;
+        }
+        for (long i = begin; i < end;)
+        {
+            // Replay add_face on the half-edges of this edge, in the order they were added:
+            // each is paired with the last one added the other way round. Normally that is
+            // just one pair, but it keeps non-manifold edges the same too.
+            int last[2] = {-1, -1}; // last half-edge seen from the smaller to the larger vertex, and back
+            long j = i;
+            for (; j < n_inner && records[j].key == records[i].key; j++)
+            {
+                int he = records[j].he, from = he_vert[he], to = he_vert[he_next[he]];
+                int dir = from < to ? 0 : 1, other = from == to ? dir : 1 - dir;
+                if (last[other] != -1)
+                {
+                    he_pair[he] = last[other];
+                    he_pair[last[other]] = he;
+                }
+                last[dir] = he;
+            }
+            i = j;
+        }
+    });
+    std::vector<EdgeRecord>().swap(records);
+
+    for (long he = 0; he < n_inner; he++)
+    {
+        vert_he[he_vert[he]] = he;
+    }
+
+    // close the boundary
+    std::vector<int> boundary;
+    for (long he = 0; he < n_inner; he++)
+    {
+        if (he_pair[he] == -1)
+        {
+            boundary.push_back(he);
+        }
+    }
+    n_he = n_inner + boundary.size();
+    he_vert.resize(n_he);
+    he_next.resize(n_he);
+    he_pair.resize(n_he);
+    he_tri.resize(n_he, -1);
+    for (int b = 0; b < boundary.size(); b++)
+    {
+        int he = boundary[b], outer = n_inner + b;
+        he_vert[outer] = he_vert[he_next[he]];
+        he_pair[outer] = he;
+        he_pair[he] = outer;
+        vert_he[he_vert[outer]] = outer;
+    }
+    for (int outer = n_inner; outer < n_he; outer++)
     {
-        add_face(face);
+        he_next[outer] = vert_he[he_vert[he_pair[outer]]];
     }
-    set_boundary();
+
+    // the edge index, with the last half-edge of each direction winning like in add_face
+    he_map.clear();
+    he_map.reserve(n_he);
+    for (int he = 0; he < n_he; he++)
+    {
+        he_map.set(he_vert[he], he_vert[he_pair[he]], he);
+    }
+
+    n_verts = vert_pos.size();
+    n_tris = n_faces;
 }
 
 int HalfEdgeMesh::he_prev(int he)
@@ -230,6 +715,7 @@ int HalfEdgeMesh::he_prev(int he)
 
 void HalfEdgeMesh::edge_flip(int he)
 {
+    topology_version++;
     // check if edge is not boundary
     assert(he_tri[he] != -1 && he_tri[he_pair[he]] != -1);
     // get pointers
@@ -269,14 +755,19 @@ void HalfEdgeMesh::edge_flip(int he)
     he_tri[pair_next] = tri;
     he_tri[pair_prev] = pair_tri;
     he_tri[next] = pair_tri;
-    he_map.erase((uint64_t(origin) << 32) | pair_origin);
-    he_map.erase((uint64_t(pair_origin) << 32) | origin);
-    he_map[(uint64_t(new_origin) << 32) | new_pair_origin] = he;
-    he_map[(uint64_t(new_pair_origin) << 32) | new_origin] = pair;
+    he_map.erase(origin, pair_origin);
+    he_map.erase(pair_origin, origin);
+    he_map.set(new_origin, new_pair_origin, he);
+    he_map.set(new_pair_origin, new_origin, pair);
+    for (int v : {origin, pair_origin, new_origin, new_pair_origin})
+    {
+        mark_moved(v);
+    }
 }
 
-void HalfEdgeMesh::edge_split(int he)
+int HalfEdgeMesh::edge_split(int he)
 {
+    topology_version++;
 
     // flip he to get he on the boundary
     if (he_tri[he_pair[he]] == -1)
@@ -297,132 +788,122 @@ void HalfEdgeMesh::edge_split(int he)
     int tri = he_tri[he];
     int pair_tri = he_tri[pair];
 
+    int v = new_vert();
     if (tri != -1)
     {
-        vert_pos.push_back((vert_pos[origin] + vert_pos[pair_origin]) / 2.0f);
-        vert_normal.push_back(glm::vec3(0, 0, 0));
-        vert_he.push_back(he);
-        vert_he[origin] = n_he;
+        int h[6] = {new_he(), new_he(), new_he(), new_he(), new_he(), new_he()};
+        int t[2] = {new_tri(), new_tri()};
+        vert_pos[v] = (vert_pos[origin] + vert_pos[pair_origin]) / 2.0f;
+        vert_normal[v] = glm::vec3(0, 0, 0);
+        vert_he[v] = he;
+        vert_he[origin] = h[0];
         vert_he[pair_origin] = pair;
         vert_he[prev_origin] = prev;
         vert_he[pair_prev_origin] = pair_prev;
         tri_he[pair_tri] = pair;
         tri_he[tri] = he;
-        tri_he.resize(n_tris + 2);
-        tri_he[n_tris] = pair_next;
-        tri_he[n_tris + 1] = prev;
-        tri_verts.resize(n_tris + 2);
-        tri_verts[tri] = glm::ivec3(n_verts, pair_origin, prev_origin);
-        tri_verts[pair_tri] = glm::ivec3(n_verts, pair_prev_origin, pair_origin);
-        tri_verts[n_tris] = glm::ivec3(n_verts, origin, pair_prev_origin);
-        tri_verts[n_tris + 1] = glm::ivec3(n_verts, prev_origin, origin);
-        he_vert.resize(n_he + 6);
-        he_vert[he] = n_verts;
+        tri_he[t[0]] = pair_next;
+        tri_he[t[1]] = prev;
+        tri_verts[tri] = glm::ivec3(v, pair_origin, prev_origin);
+        tri_verts[pair_tri] = glm::ivec3(v, pair_prev_origin, pair_origin);
+        tri_verts[t[0]] = glm::ivec3(v, origin, pair_prev_origin);
+        tri_verts[t[1]] = glm::ivec3(v, prev_origin, origin);
+        he_vert[he] = v;
         he_vert[pair] = pair_origin;
-        he_vert[n_he] = origin;
-        he_vert[n_he + 1] = n_verts;
-        he_vert[n_he + 2] = pair_prev_origin;
-        he_vert[n_he + 3] = n_verts;
-        he_vert[n_he + 4] = prev_origin;
-        he_vert[n_he + 5] = n_verts;
-        he_next.resize(n_he + 6);
-        he_next[next] = n_he + 4;
-        he_next[n_he + 4] = he;
-        he_next[pair] = n_he + 3;
-        he_next[n_he + 3] = pair_prev;
+        he_vert[h[0]] = origin;
+        he_vert[h[1]] = v;
+        he_vert[h[2]] = pair_prev_origin;
+        he_vert[h[3]] = v;
+        he_vert[h[4]] = prev_origin;
+        he_vert[h[5]] = v;
+        he_next[next] = h[4];
+        he_next[h[4]] = he;
+        he_next[pair] = h[3];
+        he_next[h[3]] = pair_prev;
         he_next[pair_prev] = pair;
-        he_next[pair_next] = n_he + 2;
-        he_next[n_he + 2] = n_he + 1;
-        he_next[n_he + 1] = pair_next;
-        he_next[prev] = n_he;
-        he_next[n_he] = n_he + 5;
-        he_next[n_he + 5] = prev;
-        he_pair.resize(n_he + 6);
+        he_next[pair_next] = h[2];
+        he_next[h[2]] = h[1];
+        he_next[h[1]] = pair_next;
+        he_next[prev] = h[0];
+        he_next[h[0]] = h[5];
+        he_next[h[5]] = prev;
         he_pair[he] = pair;
         he_pair[pair] = he;
-        he_pair[n_he] = n_he + 1;
-        he_pair[n_he + 1] = n_he;
-        he_pair[n_he + 2] = n_he + 3;
-        he_pair[n_he + 3] = n_he + 2;
-        he_pair[n_he + 4] = n_he + 5;
-        he_pair[n_he + 5] = n_he + 4;
-        he_tri.resize(n_he + 6);
-        he_tri[n_he + 4] = tri;
-        he_tri[n_he + 3] = pair_tri;
-        he_tri[prev] = n_tris + 1;
-        he_tri[n_he] = n_tris + 1;
-        he_tri[n_he + 5] = n_tris + 1;
-        he_tri[pair_next] = n_tris;
-        he_tri[n_he + 2] = n_tris;
-        he_tri[n_he + 1] = n_tris;
-        he_map.erase((uint64_t(origin) << 32) | pair_origin);
-        he_map.erase((uint64_t(pair_origin) << 32) | origin);
-        he_map[(uint64_t(n_verts) << 32) | origin] = n_he + 1;
-        he_map[(uint64_t(n_verts) << 32) | prev_origin] = n_he + 5;
-        he_map[(uint64_t(n_verts) << 32) | pair_origin] = he;
-        he_map[(uint64_t(n_verts) << 32) | pair_prev_origin] = n_he + 3;
-        he_map[(uint64_t(origin) << 32) | n_verts] = n_he;
-        he_map[(uint64_t(prev_origin) << 32) | n_verts] = n_he + 4;
-        he_map[(uint64_t(pair_origin) << 32) | n_verts] = pair;
-        he_map[(uint64_t(pair_prev_origin) << 32) | n_verts] = n_he + 2;
-        n_verts++;
-        n_he += 6;
-        n_tris += 2;
+        he_pair[h[0]] = h[1];
+        he_pair[h[1]] = h[0];
+        he_pair[h[2]] = h[3];
+        he_pair[h[3]] = h[2];
+        he_pair[h[4]] = h[5];
+        he_pair[h[5]] = h[4];
+        he_tri[h[4]] = tri;
+        he_tri[h[3]] = pair_tri;
+        he_tri[prev] = t[1];
+        he_tri[h[0]] = t[1];
+        he_tri[h[5]] = t[1];
+        he_tri[pair_next] = t[0];
+        he_tri[h[2]] = t[0];
+        he_tri[h[1]] = t[0];
+        he_map.erase(origin, pair_origin);
+        he_map.erase(pair_origin, origin);
+        he_map.set(v, origin, h[1]);
+        he_map.set(v, prev_origin, h[5]);
+        he_map.set(v, pair_origin, he);
+        he_map.set(v, pair_prev_origin, h[3]);
+        he_map.set(origin, v, h[0]);
+        he_map.set(prev_origin, v, h[4]);
+        he_map.set(pair_origin, v, pair);
+        he_map.set(pair_prev_origin, v, h[2]);
+        mark_moved(v); // every triangle that changed has the new vertex
     }
     else // boundary case
     {
-        vert_pos.push_back((vert_pos[origin] + vert_pos[pair_origin]) / 2.0f);
-        vert_normal.push_back(glm::vec3(0, 0, 0));
-        vert_he.push_back(he);
-        vert_he[origin] = n_he;
+        int h[4] = {new_he(), new_he(), new_he(), new_he()};
+        int t[1] = {new_tri()};
+        vert_pos[v] = (vert_pos[origin] + vert_pos[pair_origin]) / 2.0f;
+        vert_normal[v] = glm::vec3(0, 0, 0);
+        vert_he[v] = he;
+        vert_he[origin] = h[0];
         vert_he[pair_origin] = pair;
         vert_he[prev_origin] = prev;
         vert_he[pair_prev_origin] = pair_prev;
         tri_he[pair_tri] = pair;
-        tri_he.resize(n_tris + 1);
-        tri_he[n_tris] = pair_next;
-        tri_verts.resize(n_tris + 1);
-        tri_verts[pair_tri] = glm::ivec3(n_verts, pair_prev_origin, pair_origin);
-        tri_verts[n_tris] = glm::ivec3(n_verts, origin, pair_prev_origin);
-        he_vert.resize(n_he + 4);
-        he_vert[he] = n_verts;
+        tri_he[t[0]] = pair_next;
+        tri_verts[pair_tri] = glm::ivec3(v, pair_prev_origin, pair_origin);
+        tri_verts[t[0]] = glm::ivec3(v, origin, pair_prev_origin);
+        he_vert[he] = v;
         he_vert[pair] = pair_origin;
-        he_vert[n_he] = origin;
-        he_vert[n_he + 1] = n_verts;
-        he_vert[n_he + 2] = pair_prev_origin;
-        he_vert[n_he + 3] = n_verts;
-        he_next.resize(n_he + 4);
-        he_next[pair] = n_he + 3;
-        he_next[n_he + 3] = pair_prev;
+        he_vert[h[0]] = origin;
+        he_vert[h[1]] = v;
+        he_vert[h[2]] = pair_prev_origin;
+        he_vert[h[3]] = v;
+        he_next[pair] = h[3];
+        he_next[h[3]] = pair_prev;
         he_next[pair_prev] = pair;
-        he_next[pair_next] = n_he + 2;
-        he_next[n_he + 2] = n_he + 1;
-        he_next[n_he + 1] = pair_next;
-        he_next[prev] = n_he;
-        he_next[n_he] = he;
-        he_pair.resize(n_he + 4);
-        he_pair[n_he] = n_he + 1;
-        he_pair[n_he + 1] = n_he;
-        he_pair[n_he + 2] = n_he + 3;
-        he_pair[n_he + 3] = n_he + 2;
-        he_tri.resize(n_he + 4);
-        he_tri[n_he + 3] = pair_tri;
-        he_tri[n_he] = -1;
-        he_tri[pair_next] = n_tris;
-        he_tri[n_he + 2] = n_tris;
-        he_tri[n_he + 1] = n_tris;
-        he_map.erase((uint64_t(origin) << 32) | pair_origin);
-        he_map.erase((uint64_t(pair_origin) << 32) | origin);
-        he_map[(uint64_t(n_verts) << 32) | origin] = n_he + 1;
-        he_map[(uint64_t(n_verts) << 32) | pair_origin] = he;
-        he_map[(uint64_t(n_verts) << 32) | pair_prev_origin] = n_he + 3;
-        he_map[(uint64_t(origin) << 32) | n_verts] = n_he;
-        he_map[(uint64_t(pair_origin) << 32) | n_verts] = pair;
-        he_map[(uint64_t(pair_prev_origin) << 32) | n_verts] = n_he + 2;
-        n_verts++;
-        n_he += 4;
-        n_tris += 1;
+        he_next[pair_next] = h[2];
+        he_next[h[2]] = h[1];
+        he_next[h[1]] = pair_next;
+        he_next[prev] = h[0];
+        he_next[h[0]] = he;
+        he_pair[h[0]] = h[1];
+        he_pair[h[1]] = h[0];
+        he_pair[h[2]] = h[3];
+        he_pair[h[3]] = h[2];
+        he_tri[h[3]] = pair_tri;
+        he_tri[h[0]] = -1;
+        he_tri[pair_next] = t[0];
+        he_tri[h[2]] = t[0];
+        he_tri[h[1]] = t[0];
+        he_map.erase(origin, pair_origin);
+        he_map.erase(pair_origin, origin);
+        he_map.set(v, origin, h[1]);
+        he_map.set(v, pair_origin, he);
+        he_map.set(v, pair_prev_origin, h[3]);
+        he_map.set(origin, v, h[0]);
+        he_map.set(pair_origin, v, pair);
+        he_map.set(pair_prev_origin, v, h[2]);
+        mark_moved(v); // every triangle that changed has the new vertex
     }
+    return v;
 }
 
 bool HalfEdgeMesh::v_in_tri(int tri, int v)
@@ -430,7 +911,7 @@ bool HalfEdgeMesh::v_in_tri(int tri, int v)
     return (tri != -1) && (tri_verts[tri][0] == v || tri_verts[tri][1] == v || tri_verts[tri][2] == v);
 }
 
-bool HalfEdgeMesh::collapse_check(int he)
+bool HalfEdgeMesh::collapse_check(int he, bool check_geometry)
 {
     // https://www.merlin.uzh.ch/contributionDocument/download/14550
     int pair = he_pair[he];
@@ -448,9 +929,9 @@ bool HalfEdgeMesh::collapse_check(int he)
     bool boundary_1 = false, boundary_2 = false;
     for (int i = 0; i < vertices1.size(); i++)
     {
-        int v1_i = he_map[(uint64_t(v1) << 32) | vertices1[i]];
+        int v1_i = he_map.find(v1, vertices1[i]);
         int v1_i_pair = he_pair[v1_i];
-        if (tri_he[v1_i] == -1 || tri_he[v1_i_pair] == -1)
+        if (he_tri[v1_i] == -1 || he_tri[v1_i_pair] == -1)
         {
             boundary_1 = true;
             break;
@@ -458,9 +939,9 @@ bool HalfEdgeMesh::collapse_check(int he)
     }
     for (int i = 0; i < vertices2.size(); i++)
     {
-        int v2_i = he_map[(uint64_t(v2) << 32) | vertices2[i]];
+        int v2_i = he_map.find(v2, vertices2[i]);
         int v2_i_pair = he_pair[v2_i];
-        if (tri_he[v2_i] == -1 || tri_he[v2_i_pair] == -1)
+        if (he_tri[v2_i] == -1 || he_tri[v2_i_pair] == -1)
         {
             boundary_2 = true;
             break;
@@ -485,20 +966,20 @@ bool HalfEdgeMesh::collapse_check(int he)
     }
     if (common.size() == 2)
     {
-        checks &= (he_map.find((uint64_t(common[0]) << 32) | common[1]) == he_map.end());
+        checks &= (he_map.find(common[0], common[1]) == -1);
     }
 
-    checks &= (n_verts >= 4);
+    checks &= (n_verts - (int)free_verts.size() >= 4);
 
     // geometric checks
     vertices1.erase(std::find(vertices1.begin(), vertices1.end(), v2));
     vertices2.erase(std::find(vertices2.begin(), vertices2.end(), v1));
 
-    for (int i = 0; i < vertices1.size(); i++)
+    for (int i = 0; check_geometry && i < vertices1.size(); i++)
     {
-        if (he_map.find((uint64_t(vertices1[(i + 1) % vertices1.size()]) << 32) | vertices1[i]) != he_map.end())
+        int i_he = he_map.find(vertices1[(i + 1) % vertices1.size()], vertices1[i]);
+        if (i_he != -1)
         {
-            int i_he = he_map[(uint64_t(vertices1[(i + 1) % vertices1.size()]) << 32) | vertices1[i]];
             int i_tri = he_tri[i_he];
             int i_pair = he_pair[i_he];
             int i_tri_pair = he_tri[i_pair];
@@ -515,11 +996,11 @@ bool HalfEdgeMesh::collapse_check(int he)
         }
     }
 
-    for (int i = 0; i < vertices2.size(); i++)
+    for (int i = 0; check_geometry && i < vertices2.size(); i++)
     {
-        if (he_map.find((uint64_t(vertices2[(i + 1) % vertices2.size()]) << 32) | vertices2[i]) != he_map.end())
+        int i_he = he_map.find(vertices2[(i + 1) % vertices2.size()], vertices2[i]);
+        if (i_he != -1)
         {
-            int i_he = he_map[(uint64_t(vertices2[(i + 1) % vertices2.size()]) << 32) | vertices2[i]];
             int i_tri = he_tri[i_he];
             int i_pair = he_pair[i_he];
             int i_tri_pair = he_tri[i_pair];
@@ -531,7 +1012,7 @@ bool HalfEdgeMesh::collapse_check(int he)
             checks &= (glm::length(normal) > 0.3);
             checks &= (glm::dot(normalize(normal), glm::normalize(vert_pos[vertices2[i]] - vert_pos[v2])) *
                            glm::dot(normalize(normal),
-                                    glm::normalize(vert_pos[vertices2[i]] - (vert_pos[v2] + vert_pos[v2]) / 2.0f)) >
+                                    glm::normalize(vert_pos[vertices2[i]] - (vert_pos[v1] + vert_pos[v2]) / 2.0f)) >
                        0.01);
         }
     }
@@ -547,6 +1028,7 @@ bool HalfEdgeMesh::collapse_check(int he)
 
 void HalfEdgeMesh::edge_collapse(int he)
 {
+    topology_version++;
     // check if edge can be collapsed
     int pair = he_pair[he];
     int v1 = he_vert[he];
@@ -568,7 +1050,7 @@ void HalfEdgeMesh::edge_collapse(int he)
 
     for (int i = 0; i < common.size(); i++)
     {
-        vert_he[common[i]] = he_map[(uint64_t(common[i]) << 32) | v1];
+        vert_he[common[i]] = he_map.find(common[i], v1);
     }
     // get relevant pointers
     int tri1 = he_tri[he];
@@ -578,7 +1060,7 @@ void HalfEdgeMesh::edge_collapse(int he)
     int next_pair = he_next[pair];
     int prev_pair = he_prev(pair);
 
-    vert_he[v1] = he_map[(uint64_t(v1) << 32) | common[0]];
+    vert_he[v1] = he_map.find(v1, common[0]);
     // handle he_next continuity when he is a boundary edge
     if (tri1 == -1)
     {
@@ -590,7 +1072,7 @@ void HalfEdgeMesh::edge_collapse(int he)
     }
     for (int i = 0; i < vertices2.size(); i++)
     {
-        int v2_i = he_map[(uint64_t(v2) << 32) | vertices2[i]];
+        int v2_i = he_map.find(v2, vertices2[i]);
         int v2_i_pair = he_pair[v2_i];
         int tri = he_tri[v2_i];
         int tri_pair = he_tri[v2_i_pair];
@@ -622,161 +1104,256 @@ void HalfEdgeMesh::edge_collapse(int he)
             if (he_vert[v2_i_prev] == common[idx])
             {
                 // std::cout << common[idx] << "detected";
-                he_next[he_prev(v2_i_prev)] = he_map[(uint64_t(common[idx]) << 32) | v1];
-                he_next[he_map[(uint64_t(common[idx]) << 32) | v1]] = v2_i;
-                assert(he_tri[he_map[(uint64_t(common[idx]) << 32) | v1]] == tri1 ||
-                       he_tri[he_map[(uint64_t(common[idx]) << 32) | v1]] == tri2);
-                he_tri[he_map[(uint64_t(common[idx]) << 32) | v1]] = tri;
+                he_next[he_prev(v2_i_prev)] = he_map.find(common[idx], v1);
+                he_next[he_map.find(common[idx], v1)] = v2_i;
+                assert(he_tri[he_map.find(common[idx], v1)] == tri1 ||
+                       he_tri[he_map.find(common[idx], v1)] == tri2);
+                he_tri[he_map.find(common[idx], v1)] = tri;
             }
             if (he_vert[he_next[he_next[v2_i_pair]]] == common[idx])
             {
-                he_next[he_map[(uint64_t(v1) << 32) | common[idx]]] = he_next[he_next[v2_i_pair]];
-                he_next[v2_i_pair] = he_map[(uint64_t(v1) << 32) | common[idx]];
-                he_tri[he_map[(uint64_t(v1) << 32) | common[idx]]] = tri_pair;
+                he_next[he_map.find(v1, common[idx])] = he_next[he_next[v2_i_pair]];
+                he_next[v2_i_pair] = he_map.find(v1, common[idx]);
+                he_tri[he_map.find(v1, common[idx])] = tri_pair;
             }
         }
         he_vert[v2_i] = v1;
     }
     for (int i = 0; i < vertices2.size(); i++)
     {
-        int v2_i = he_map[(uint64_t(v2) << 32) | vertices2[i]];
+        int v2_i = he_map.find(v2, vertices2[i]);
         int v2_i_pair = he_pair[v2_i];
-        he_map.erase((uint64_t(v2) << 32) | vertices2[i]);
-        he_map.erase((uint64_t(vertices2[i]) << 32) | v2);
-        he_map[(uint64_t(v1) << 32) | vertices2[i]] = v2_i;
-        he_map[(uint64_t(vertices2[i]) << 32) | v1] = v2_i_pair;
+        he_map.erase(v2, vertices2[i]);
+        he_map.erase(vertices2[i], v2);
+        he_map.set(v1, vertices2[i], v2_i);
+        he_map.set(vertices2[i], v1, v2_i_pair);
     }
     vert_pos[v1] = (vert_pos[v1] + vert_pos[v2]) / 2.0f;
+    mark_moved(v1); // every triangle that changed has v1
 
-    std::vector<int> order_list = {he, pair};
+    std::vector<int> dead = {he, pair};
     for (int i : common)
     {
-        order_list.push_back(he_map[(uint64_t(v2) << 32) | i]);
-        order_list.push_back(he_map[(uint64_t(i) << 32) | v2]);
-        he_map.erase((uint64_t(v2) << 32) | i);
-        he_map.erase((uint64_t(i) << 32) | v2);
+        dead.push_back(he_map.find(v2, i));
+        dead.push_back(he_map.find(i, v2));
+        he_map.erase(v2, i);
+        he_map.erase(i, v2);
     }
-    he_map.erase((uint64_t(v1) << 32) | v2);
-    he_map.erase((uint64_t(v2) << 32) | v1);
-    std::sort(order_list.begin(), order_list.end());
-    for (int i = order_list.size() - 1; i >= 0; i--)
+    he_map.erase(v1, v2);
+    he_map.erase(v2, v1);
+    for (int i : dead)
     {
-        delete_he(order_list[i]);
+        delete_he(i);
     }
-    delete_tri(std::max(tri1, tri2));
-    delete_tri(std::min(tri1, tri2));
+    delete_tri(tri1);
+    delete_tri(tri2);
     delete_vert(v2);
 }
 
+// Deleted elements are only marked dead (vert_he, he_vert or tri_he -1) and
+// put on a free list, for new_vert, new_he and new_tri to hand out again;
+// compact() removes whatever is still dead.
 void HalfEdgeMesh::delete_tri(int tri)
 {
+    topology_version++;
     if (tri == -1)
     {
         return;
     }
-    if (tri == n_tris - 1)
-    {
-        tri_he.pop_back();
-        tri_verts.pop_back();
-        n_tris--;
-        return;
-    }
-    int he = tri_he.back();
-    assert(he_tri[he] == n_tris - 1);
-    he_tri[he] = tri;
-    he = he_next[he];
-    while (he != tri_he.back())
+    tri_he[tri] = -1;
+    tri_verts[tri] = glm::ivec3(0, 0, 0); // degenerate, so it draws nothing
+    free_tris.push_back(tri);
+}
+
+void HalfEdgeMesh::delete_he(int he)
+{
+    topology_version++;
+    he_vert[he] = -1;
+    he_next[he] = -1;
+    he_pair[he] = -1;
+    he_tri[he] = -1;
+    free_he.push_back(he);
+}
+
+void HalfEdgeMesh::delete_vert(int vert)
+{
+    topology_version++;
+    vert_he[vert] = -1;
+    free_verts.push_back(vert);
+}
+
+int HalfEdgeMesh::new_vert()
+{
+    if (!free_verts.empty())
     {
-        he_tri[he] = tri;
-        he = he_next[he];
+        int vert = free_verts.back();
+        free_verts.pop_back();
+        return vert;
     }
-    tri_he[tri] = tri_he.back();
-    tri_verts[tri] = tri_verts.back();
-    tri_he.pop_back();
-    tri_verts.pop_back();
-    n_tris--;
+    vert_he.resize(n_verts + 1, -1);
+    vert_pos.resize(n_verts + 1);
+    vert_normal.resize(n_verts + 1);
+    return n_verts++;
 }
 
-void HalfEdgeMesh::delete_he(int he)
+int HalfEdgeMesh::new_he()
 {
-    if (he == n_he - 1)
+    if (!free_he.empty())
     {
-        he_pair.pop_back();
-        he_next.pop_back();
-        he_tri.pop_back();
-        he_vert.pop_back();
-        n_he--;
-        return;
+        int he = free_he.back();
+        free_he.pop_back();
+        return he;
     }
-    int pair = he_pair.back();
-    int v1 = he_vert.back();
-    int v2 = he_vert[pair];
-    int prev = he_prev(n_he - 1);
-    vert_he[v1] = he;
-    if (he_tri.back() != -1)
+    he_vert.resize(n_he + 1, -1);
+    he_next.resize(n_he + 1, -1);
+    he_pair.resize(n_he + 1, -1);
+    he_tri.resize(n_he + 1, -1);
+    return n_he++;
+}
+
+int HalfEdgeMesh::new_tri()
+{
+    if (!free_tris.empty())
     {
-        tri_he[he_tri.back()] = he;
+        int tri = free_tris.back();
+        free_tris.pop_back();
+        return tri;
     }
-    he_next[prev] = he;
-    he_next[he] = he_next.back();
-    he_pair[pair] = he;
-    he_pair[he] = pair;
-    he_tri[he] = he_tri.back();
-    he_vert[he] = v1;
-    he_map[(uint64_t(v1) << 32) | v2] = he;
-    he_vert.pop_back();
-    he_next.pop_back();
-    he_pair.pop_back();
-    he_tri.pop_back();
-    n_he--;
+    tri_he.resize(n_tris + 1, -1);
+    tri_verts.resize(n_tris + 1);
+    return n_tris++;
 }
 
-void HalfEdgeMesh::delete_vert(int vert)
+// The new index of every element that isn't on free: the live ones in order.
+static int renumber(std::vector<int> &remap, int n, const std::vector<int> &free)
 {
-    if (vert == n_verts - 1)
+    remap.assign(n, 0);
+    for (int i : free)
     {
-        vert_he.pop_back();
-        vert_normal.pop_back();
-        vert_pos.pop_back();
-        n_verts--;
-        return;
+        remap[i] = -1;
     }
-    vert_pos[vert] = vert_pos.back();
-    vert_normal[vert] = vert_normal.back();
-    vert_he[vert] = vert_he.back();
-    std::vector<int> vertices = get_adjacent_vertices(n_verts - 1);
-    for (int i = 0; i < vertices.size(); i++)
+    int next = 0;
+    for (int i = 0; i < n; i++)
     {
-        int he = he_map[(uint64_t(vertices[i]) << 32) | (n_verts - 1)];
-        int pair = he_pair[he];
-        int tri_1 = he_tri[he];
-        int tri_2 = he_tri[pair];
-        for (int idx = 0; idx < 3; idx++)
+        if (remap[i] != -1)
+        {
+            remap[i] = next++;
+        }
+    }
+    return next;
+}
+
+HalfEdgeMesh::Remap HalfEdgeMesh::compact()
+{
+    topology_version++;
+    Remap remap;
+    int verts = renumber(remap.verts, n_verts, free_verts);
+    int hes = renumber(remap.he, n_he, free_he);
+    int tris = renumber(remap.tris, n_tris, free_tris);
+    // Every element moves down to its new index, which is never past the old
+    // one, so this can be done in place in increasing order.
+    for (int v = 0; v < n_verts; v++)
+    {
+        int to = remap.verts[v];
+        if (to != -1)
         {
-            if (tri_1 != -1 && tri_verts[tri_1][idx] == n_verts - 1)
+            vert_he[to] = vert_he[v] == -1 ? -1 : remap.he[vert_he[v]];
+            vert_pos[to] = vert_pos[v];
+            // normals and gravity may not have been computed yet
+            if (v < (int)vert_normal.size())
             {
-                tri_verts[tri_1][idx] = vert;
+                vert_normal[to] = vert_normal[v];
             }
-            if (tri_2 != -1 && tri_verts[tri_2][idx] == n_verts - 1)
+            if (v < (int)vert_gravity.size())
             {
-                tri_verts[tri_2][idx] = vert;
+                vert_gravity[to] = vert_gravity[v];
             }
         }
-        he_vert[pair] = vert;
     }
-    for (int i = 0; i < vertices.size(); i++)
+    // corner weights of half-edges added since the last update_corner_weights
+    // are missing, but their triangles are marked to be recomputed
+    for (int he = 0; he < n_he; he++)
     {
-        int he = he_map[(uint64_t(vertices[i]) << 32) | (n_verts - 1)];
-        int pair = he_pair[he];
-        he_map.erase((uint64_t(vertices[i]) << 32) | (n_verts - 1));
-        he_map.erase((uint64_t(n_verts - 1) << 32) | vertices[i]);
-        he_map[(uint64_t(vertices[i]) << 32) | vert] = he;
-        he_map[(uint64_t(vert) << 32) | vertices[i]] = pair;
-    }
-    vert_he.pop_back();
-    vert_pos.pop_back();
-    vert_normal.pop_back();
-    n_verts--;
+        int to = remap.he[he];
+        if (to != -1)
+        {
+            he_vert[to] = remap.verts[he_vert[he]];
+            he_next[to] = remap.he[he_next[he]];
+            he_pair[to] = remap.he[he_pair[he]];
+            he_tri[to] = he_tri[he] == -1 ? -1 : remap.tris[he_tri[he]];
+            if (he < (int)he_cot.size())
+            {
+                he_cot[to] = he_cot[he];
+                he_area[to] = he_area[he];
+            }
+        }
+    }
+    for (int tri = 0; tri < n_tris; tri++)
+    {
+        int to = remap.tris[tri];
+        if (to != -1)
+        {
+            tri_he[to] = remap.he[tri_he[tri]];
+            glm::ivec3 v = tri_verts[tri];
+            tri_verts[to] = glm::ivec3(remap.verts[v[0]], remap.verts[v[1]], remap.verts[v[2]]);
+        }
+    }
+
+    vert_he.resize(verts);
+    vert_pos.resize(verts);
+    vert_normal.resize(std::min<size_t>(vert_normal.size(), verts));
+    vert_gravity.resize(std::min<size_t>(vert_gravity.size(), verts));
+    he_vert.resize(hes);
+    he_next.resize(hes);
+    he_pair.resize(hes);
+    he_tri.resize(hes);
+    he_cot.resize(std::min<size_t>(he_cot.size(), hes));
+    he_area.resize(std::min<size_t>(he_area.size(), hes));
+    tri_he.resize(tris);
+    tri_verts.resize(tris);
+    n_verts = verts;
+    n_he = hes;
+    n_tris = tris;
+    free_verts.clear();
+    free_he.clear();
+    free_tris.clear();
+
+    he_map.clear();
+    he_map.reserve(n_he);
+    for (int he = 0; he < n_he; he++)
+    {
+        he_map.set(he_vert[he], he_vert[he_pair[he]], he);
+    }
+    // keep what is marked for update_corner_weights, under the new indices
+    int marked = 0;
+    for (int v : weights_dirty)
+    {
+        if (remap.verts[v] != -1)
+        {
+            weights_dirty[marked++] = remap.verts[v];
+        }
+    }
+    weights_dirty.resize(marked);
+    return remap;
+}
+
+bool HalfEdgeMesh::collapse_stretches(int he, float max_length)
+{
+    int v1 = he_vert[he], v2 = he_vert[he_pair[he]];
+    glm::vec3 mid = (vert_pos[v1] + vert_pos[v2]) / 2.0f;
+    for (int v : {v1, v2})
+    {
+        int out = vert_he[v];
+        do
+        {
+            if (glm::length(vert_pos[he_vert[he_pair[out]]] - mid) > max_length)
+            {
+                return true;
+            }
+            out = he_next[he_pair[out]];
+        } while (out != vert_he[v]);
+    }
+    return false;
 }
 
 float HalfEdgeMesh::he_length(int he)
@@ -786,64 +1363,51 @@ float HalfEdgeMesh::he_length(int he)
     return glm::length(vert_pos[v1] - vert_pos[v2]);
 }
 
-float cotan(float angle)
-{
-    return cos(angle) / sin(angle);
-}
-
 void HalfEdgeMesh::assign_weights()
 {
-    vert_gravity.clear();
-    vert_gravity.resize(n_verts, glm::vec3(0.0, 0.0, 0.0));
+    update_corner_weights();
+    // the mixed Voronoi area of each vertex, from the corners it leaves from
     std::vector<float> vert_areas(n_verts, 0.0);
-    // assign gravity to all vertices
-    for (int q = 0; q < n_verts; q++)
-    {
-        std::vector<int> vertices = get_adjacent_vertices(q);
-        for (int i = 0; i < vertices.size(); i++)
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long q = begin; q < end; q++)
         {
-            if (he_map.find((uint64_t(vertices[(i + 1) % vertices.size()]) << 32) | vertices[i]) != he_map.end())
+            int he = vert_he[q];
+            if (he == -1)
+            {
+                continue;
+            }
+            do
             {
-                int he = he_map[(uint64_t(vertices[(i + 1) % vertices.size()]) << 32) | vertices[i]];
-                int tri = he_tri[he];
-                if ((tri != -1) && (tri_verts[tri][0] == q || tri_verts[tri][1] == q || tri_verts[tri][2] == q))
+                if (he_tri[he] != -1)
                 {
-                    glm::vec3 q_one = vert_pos[vertices[i]] - vert_pos[q];
-                    glm::vec3 one_two = vert_pos[vertices[(i + 1) % vertices.size()]] - vert_pos[vertices[i]];
-                    glm::vec3 two_q = vert_pos[q] - vert_pos[vertices[(i + 1) % vertices.size()]];
-                    float alpha_i = acos(glm::dot(q_one / glm::length(q_one), -two_q / glm::length(two_q)));
-                    float alpha_j = acos(glm::dot(-q_one / glm::length(q_one), one_two / glm::length(one_two)));
-                    float alpha_k = acos(glm::dot(two_q / glm::length(two_q), -one_two / glm::length(one_two)));
-                    if (std::max({alpha_i, alpha_j, alpha_k}) <= M_PI / 2)
-                    {
-                        vert_areas[q] += (cotan(alpha_j) * glm::length(two_q) * glm::length(two_q) +
-                                          cotan(alpha_k) * glm::length(q_one) * glm::length(q_one)) /
-                                         8.0;
-                    }
-                    else if (alpha_i > M_PI / 2)
-                    {
-                        vert_areas[q] += 0.25 * glm::length(q_one) * glm::length(two_q) * sin(alpha_i);
-                    }
-                    else
-                    {
-                        vert_areas[q] += 0.125 * glm::length(q_one) * glm::length(two_q) * sin(alpha_i);
-                    }
+                    vert_areas[q] += he_area[he];
                 }
-            }
+                he = he_next[he_pair[he]];
+            } while (he != vert_he[q]);
         }
-    }
+    });
 
-    for (int i = 0; i < n_verts; i++)
-    {
-        float denom = 0;
-        std::vector<int> vertices = get_adjacent_vertices(i);
-        for (int j = 0; j < vertices.size(); j++)
+    // gravity: the area-weighted centroid of the neighbours
+    vert_gravity.assign(n_verts, glm::vec3(0.0, 0.0, 0.0));
+    parallel_chunks(n_verts, [&](int c, long begin, long end) {
+        for (long i = begin; i < end; i++)
         {
-            vert_gravity[i] += vert_areas[vertices[j]] * vert_pos[vertices[j]];
-            denom += vert_areas[vertices[j]];
+            float denom = 0;
+            int he = vert_he[i];
+            if (he == -1)
+            {
+                continue;
+            }
+            do
+            {
+                int v = he_vert[he_pair[he]];
+                vert_gravity[i] += vert_areas[v] * vert_pos[v];
+                denom += vert_areas[v];
+                he = he_next[he_pair[he]];
+            } while (he != vert_he[i]);
+            vert_gravity[i] /= denom;
         }
-        vert_gravity[i] /= denom;
-    }
+    });
 }
 
 bool HalfEdgeMesh::flip_check(int he)
@@ -897,6 +1461,7 @@ bool HalfEdgeMesh::split_check(int he)
 
 void HalfEdgeMesh::remeshing(float l, float lambda)
 {
+    vert_normal.resize(n_verts); // splits and collapses keep it in step with vert_pos
 
     for (int i = 0; i < n_he; i++)
     {
@@ -907,11 +1472,13 @@ void HalfEdgeMesh::remeshing(float l, float lambda)
     }
     for (int i = 0; i < n_he; i++)
     {
-        if (he_length(i) < (4 * l) / 5 && collapse_check(i) && collapse_check(he_pair[i]))
+        if (he_vert[i] != -1 && he_length(i) < (4 * l) / 5 && !collapse_stretches(i, (4 * l) / 3) &&
+            collapse_check(i) && collapse_check(he_pair[i]))
         {
             edge_collapse(i);
         }
     }
+    compact();
     recompute_vertex_normals();
     assign_weights();
     for (int i = 0; i < n_verts; i++)
@@ -919,6 +1486,287 @@ void HalfEdgeMesh::remeshing(float l, float lambda)
         vert_pos[i] = vert_pos[i] + lambda * (glm::mat3(1.0f) - glm::outerProduct(vert_normal[i], vert_normal[i])) *
                                         (vert_gravity[i] - vert_pos[i]);
     }
+    weights_stale = true;
+}
+
+// An edge waiting in one of incremental_remeshing's queues. It is kept by its
+// endpoints, since collapses renumber half-edges, and checked again when popped.
+struct EdgeCandidate
+{
+    float priority; // highest first
+    int from, to;
+
+    bool operator<(const EdgeCandidate &other) const
+    {
+        return priority < other.priority;
+    }
+};
+
+int HalfEdgeMesh::incremental_remeshing(float l, float lambda, int max_iter)
+{
+    const float high = (4 * l) / 3, low = (4 * l) / 5;
+    int total_ops = 0;
+    vert_normal.resize(n_verts); // splits and collapses keep it in step with vert_pos
+
+    auto around = [&](int v, const std::function<void(int)> &visit) {
+        if (v >= n_verts || vert_he[v] == -1)
+        {
+            return;
+        }
+        int he = vert_he[v];
+        do
+        {
+            visit(he);
+            he = he_next[he_pair[he]];
+        } while (he != vert_he[v]);
+    };
+    auto on_boundary = [&](int v) {
+        bool boundary = false;
+        around(v, [&](int he) { boundary |= he_tri[he] == -1; });
+        return boundary;
+    };
+    // valence minus its target, 6 inside and 4 on the boundary, looked up once
+    // per vertex in each flip phase and kept up to date by the flips
+    std::vector<int> deviation;
+    auto valence_deviation = [&](int v) {
+        if (deviation[v] == INT_MIN)
+        {
+            int valence = 0;
+            around(v, [&](int he) { valence++; });
+            deviation[v] = valence - (on_boundary(v) ? 4 : 6);
+        }
+        return deviation[v];
+    };
+    // by how much flipping he lowers the sum of the squared deviations of the
+    // four vertices of its two triangles
+    auto flip_gain = [&](int he) {
+        int pair = he_pair[he];
+        int v[4] = {he_vert[he], he_vert[pair], he_vert[he_prev(he)], he_vert[he_prev(pair)]};
+        int change[4] = {-1, -1, 1, 1};
+        int gain = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            int d = valence_deviation(v[i]);
+            gain += d * d - (d + change[i]) * (d + change[i]);
+        }
+        return gain;
+    };
+
+    // the vertices whose edges are looked at: all of them at first, then those
+    // around the last iteration's changes
+    std::vector<int> seeds(n_verts);
+    for (int v = 0; v < n_verts; v++)
+    {
+        seeds[v] = v;
+    }
+    std::vector<int> touched;
+    std::vector<char> is_touched;
+    auto touch = [&](int v) {
+        if (v >= (int)is_touched.size())
+        {
+            is_touched.resize(v + 1, 0);
+        }
+        if (!is_touched[v])
+        {
+            is_touched[v] = 1;
+            touched.push_back(v);
+        }
+    };
+    auto touch_ring = [&](int v) {
+        touch(v);
+        around(v, [&](int he) { touch(he_vert[he_pair[he]]); });
+    };
+    std::priority_queue<EdgeCandidate> queue;
+    auto push = [&](int he, const std::function<float(int)> &priority) {
+        float p = priority(he);
+        if (p > 0)
+        {
+            queue.push(EdgeCandidate{p, he_vert[he], he_vert[he_pair[he]]});
+        }
+    };
+    auto enqueue = [&](int v, const std::function<float(int)> &priority) {
+        around(v, [&](int he) { push(he, priority); });
+    };
+    // the edges around the seeds and the touched vertices, once each
+    std::vector<char> visited;
+    auto enqueue_seeds = [&](const std::function<float(int)> &priority) {
+        visited.assign(n_verts, 0);
+        auto visit = [&](int v) {
+            if (visited[v])
+            {
+                return;
+            }
+            around(v, [&](int he) {
+                if (!visited[he_vert[he_pair[he]]])
+                {
+                    push(he, priority);
+                }
+            });
+            visited[v] = 1;
+        };
+        for (int v : seeds)
+        {
+            visit(v);
+        }
+        for (int v : touched)
+        {
+            visit(v);
+        }
+    };
+    auto pop = [&]() {
+        EdgeCandidate c = queue.top();
+        queue.pop();
+        return he_map.find(c.from, c.to);
+    };
+
+    // the priority of an edge in each queue, 0 if it doesn't belong there
+    std::function<float(int)> too_long = [&](int he) { return he_length(he) > high ? he_length(he) : 0.0f; };
+    std::function<float(int)> too_short = [&](int he) {
+        return he_length(he) < low ? 1 / (he_length(he) + 1e-30f) : 0.0f;
+    };
+    std::function<float(int)> bad_valence = [&](int he) {
+        return he_tri[he] != -1 && he_tri[he_pair[he]] != -1 ? float(flip_gain(he)) : 0.0f;
+    };
+
+    for (int iter = 0; iter < max_iter; iter++)
+    {
+        int ops = 0;
+        touched.clear();
+        is_touched.assign(n_verts, 0);
+
+        // split the longest edges first
+        enqueue_seeds(too_long);
+        while (!queue.empty())
+        {
+            int he = pop();
+            if (he == -1 || too_long(he) <= 0 || !split_check(he))
+            {
+                continue;
+            }
+            int v = edge_split(he);
+            ops++;
+            touch_ring(v);
+            enqueue(v, too_long);
+        }
+
+        // collapse the shortest edges first, unless that makes an edge too long
+        enqueue_seeds(too_short);
+        while (!queue.empty())
+        {
+            int he = pop();
+            if (he == -1 || too_short(he) <= 0)
+            {
+                continue;
+            }
+            if (collapse_stretches(he, high) || !collapse_check(he) || !collapse_check(he_pair[he]))
+            {
+                continue;
+            }
+            int v1 = he_vert[he];
+            edge_collapse(he); // merges the other end into v1
+            ops++;
+            touch_ring(v1);
+            enqueue(v1, too_short);
+        }
+
+        // flip towards valence 6 inside and 4 on the boundary, each flip bringing
+        // the valences strictly closer, which ensures it ends
+        deviation.assign(n_verts, INT_MIN);
+        enqueue_seeds(bad_valence);
+        while (!queue.empty())
+        {
+            int he = pop();
+            if (he == -1 || bad_valence(he) <= 0)
+            {
+                continue;
+            }
+            int c = he_vert[he_prev(he)], d = he_vert[he_prev(he_pair[he])];
+            if (he_map.find(c, d) != -1 || !flip_check(he))
+            {
+                continue;
+            }
+            int v[4] = {he_vert[he], he_vert[he_pair[he]], c, d};
+            edge_flip(he);
+            ops++;
+            deviation[v[0]]--;
+            deviation[v[1]]--;
+            deviation[v[2]]++;
+            deviation[v[3]]++;
+            for (int q : v)
+            {
+                touch(q);
+                enqueue(q, bad_valence);
+            }
+        }
+
+        total_ops += ops;
+        if (ops == 0)
+        {
+            break;
+        }
+
+        // tangential relaxation of what was changed and its neighbours, towards
+        // the area-weighted centroid of their neighbours; boundaries stay put
+        touched.erase(std::remove_if(touched.begin(), touched.end(), [&](int v) { return vert_he[v] == -1; }),
+                      touched.end());
+        is_touched.resize(n_verts);
+        update_vertex_normals(touched);
+        update_corner_weights();
+        auto area = [&](int v) {
+            float sum = 0;
+            around(v, [&](int he) {
+                if (he_tri[he] != -1)
+                {
+                    sum += he_area[he];
+                }
+            });
+            return sum;
+        };
+        seeds.clear();
+        for (int v : touched)
+        {
+            seeds.push_back(v);
+            around(v, [&](int he) {
+                int u = he_vert[he_pair[he]];
+                if (!is_touched[u])
+                {
+                    is_touched[u] = 1;
+                    seeds.push_back(u);
+                }
+            });
+        }
+        std::vector<glm::vec3> moved(seeds.size());
+        for (size_t i = 0; i < seeds.size(); i++)
+        {
+            int v = seeds[i];
+            moved[i] = vert_pos[v];
+            if (on_boundary(v))
+            {
+                continue;
+            }
+            glm::vec3 gravity(0.0f, 0.0f, 0.0f);
+            float denom = 0;
+            around(v, [&](int he) {
+                int u = he_vert[he_pair[he]];
+                float a = area(u);
+                gravity += a * vert_pos[u];
+                denom += a;
+            });
+            if (denom > 0)
+            {
+                gravity /= denom;
+                glm::vec3 n = vert_normal[v];
+                moved[i] += lambda * (glm::mat3(1.0f) - glm::outerProduct(n, n)) * (gravity - vert_pos[v]);
+            }
+        }
+        for (size_t i = 0; i < seeds.size(); i++)
+        {
+            vert_pos[seeds[i]] = moved[i];
+            mark_moved(seeds[i]);
+        }
+    }
+    compact();
+    return total_ops;
 }
 
 void HalfEdgeMesh::check_invariants()
@@ -929,7 +1777,7 @@ void HalfEdgeMesh::check_invariants()
     assert(n_verts == vert_normal.size());
     assert(n_verts == vert_he.size());
     // check n_he
-    assert(n_he == he_map.size());
+    assert(n_he - free_he.size() == he_map.size());
     assert(n_he == he_next.size());
     assert(n_he == he_pair.size());
     assert(n_he == he_tri.size());
@@ -938,24 +1786,63 @@ void HalfEdgeMesh::check_invariants()
     assert(n_tris == tri_he.size());
     assert(n_tris == tri_verts.size());
 
-    // check for out of bounds errors
-    assert(n_he - 1 >= *std::max_element(vert_he.begin(), vert_he.end()));
-    assert(0 <= *std::min_element(vert_he.begin(), vert_he.end()));
-    assert(n_he - 1 >= *std::max_element(tri_he.begin(), tri_he.end()));
-    assert(0 <= *std::max_element(tri_he.begin(), tri_he.end()));
+    // check the free lists: exactly the dead elements, once each
+    std::vector<char> vert_dead(n_verts, 0), he_dead(n_he, 0), tri_dead(n_tris, 0);
+    for (int v : free_verts)
+    {
+        assert(0 <= v && v < n_verts && !vert_dead[v] && vert_he[v] == -1);
+        vert_dead[v] = 1;
+    }
+    for (int he : free_he)
+    {
+        assert(0 <= he && he < n_he && !he_dead[he]);
+        he_dead[he] = 1;
+    }
+    for (int tri : free_tris)
+    {
+        assert(0 <= tri && tri < n_tris && !tri_dead[tri]);
+        tri_dead[tri] = 1;
+    }
+    for (int i = 0; i < n_he; i++)
+    {
+        assert(he_dead[i] == (he_vert[i] == -1));
+    }
+    for (int i = 0; i < n_tris; i++)
+    {
+        assert(tri_dead[i] == (tri_he[i] == -1));
+    }
+
+    // check for out of bounds errors, and references to dead elements
+    for (int i = 0; i < n_verts; i++)
+    {
+        if (!vert_dead[i])
+        {
+            assert(0 <= vert_he[i] && vert_he[i] < n_he && !he_dead[vert_he[i]]);
+        }
+    }
     for (int i = 0; i < n_tris; i++)
     {
-        assert(n_verts - 1 >= std::max({tri_verts[i][0], tri_verts[i][1], tri_verts[i][2]}));
-        assert(0 <= std::min({tri_verts[i][0], tri_verts[i][1], tri_verts[i][2]}));
-    }
-    assert(n_verts - 1 >= *std::max_element(he_vert.begin(), he_vert.end()));
-    assert(0 <= *std::min_element(he_vert.begin(), he_vert.end()));
-    assert(n_he - 1 >= *std::max_element(he_next.begin(), he_next.end()));
-    assert(0 <= *std::min_element(he_next.begin(), he_next.end()));
-    assert(n_he - 1 >= *std::max_element(he_pair.begin(), he_pair.end()));
-    assert(0 <= *std::min_element(he_pair.begin(), he_pair.end()));
-    assert(n_tris - 1 >= *std::max_element(he_tri.begin(), he_tri.end()));
-    assert(-1 <= *std::min_element(he_tri.begin(), he_tri.end()));
+        if (tri_dead[i])
+        {
+            continue;
+        }
+        assert(0 <= tri_he[i] && tri_he[i] < n_he && !he_dead[tri_he[i]]);
+        for (int j = 0; j < 3; j++)
+        {
+            assert(0 <= tri_verts[i][j] && tri_verts[i][j] < n_verts && !vert_dead[tri_verts[i][j]]);
+        }
+    }
+    for (int i = 0; i < n_he; i++)
+    {
+        if (he_dead[i])
+        {
+            continue;
+        }
+        assert(0 <= he_vert[i] && he_vert[i] < n_verts && !vert_dead[he_vert[i]]);
+        assert(0 <= he_next[i] && he_next[i] < n_he && !he_dead[he_next[i]]);
+        assert(0 <= he_pair[i] && he_pair[i] < n_he && !he_dead[he_pair[i]]);
+        assert(-1 <= he_tri[i] && he_tri[i] < n_tris && (he_tri[i] == -1 || !tri_dead[he_tri[i]]));
+    }
     for (const auto &[v1v2, he] : he_map)
     {
         assert(n_verts - 1 >= (v1v2 >> 32));
@@ -967,24 +1854,29 @@ void HalfEdgeMesh::check_invariants()
     {
         assert(n_he - 1 >= he);
         assert(0 <= he);
+        assert(!he_dead[he]);
     }
     // check if vert.he originates from vert
     for (int i = 0; i < n_verts; i++)
     {
-        assert(he_vert[vert_he[i]] == i);
+        assert(vert_dead[i] || he_vert[vert_he[i]] == i);
     }
     // check if tri.he is contained in tri
     for (int i = 0; i < n_tris; i++)
     {
-        assert(he_tri[tri_he[i]] == i);
+        assert(tri_dead[i] || he_tri[tri_he[i]] == i);
     }
     // check if tri.vs have edges in tri and tri.vs has unique vertices
     for (int i = 0; i < n_tris; i++)
     {
+        if (tri_dead[i])
+        {
+            continue;
+        }
         for (int j = 0; j < 3; j++)
         {
             assert(tri_verts[i][j] != tri_verts[i][(j + 1) % 3]);
-            assert(he_tri[he_map[(uint64_t(tri_verts[i][j]) << 32) | tri_verts[i][(j + 1) % 3]]] == i);
+            assert(he_tri[he_map.find(tri_verts[i][j], tri_verts[i][(j + 1) % 3])] == i);
         }
     }
     // check if he.source is correct
@@ -995,6 +1887,10 @@ void HalfEdgeMesh::check_invariants()
     // check if he and he.next have same face and he.next != he
     for (int i = 0; i < n_he; i++)
     {
+        if (he_dead[i])
+        {
+            continue;
+        }
         assert(he_tri[i] == he_tri[he_next[i]]);
         assert(he_next[i] != i);
     }
@@ -1006,6 +1902,10 @@ void HalfEdgeMesh::check_invariants()
     // check if he.pair.pair = he and he.pair != he
     for (int i = 0; i < n_he; i++)
     {
+        if (he_dead[i])
+        {
+            continue;
+        }
         assert(he_pair[he_pair[i]] == i);
         assert(he_pair[i] != i);
     }
@@ -1025,6 +1925,10 @@ void HalfEdgeMesh::check_invariants()
     // each half edge is part of closed loop
     for (int i = 0; i < n_he; i++)
     {
+        if (he_dead[i])
+        {
+            continue;
+        }
         int he = i;
         int cnt = 0;
         while (he_next[he] != i)
@@ -1037,7 +1941,7 @@ void HalfEdgeMesh::check_invariants()
     // each interior edge is part of loop of size 3
     for (int i = 0; i < n_he; i++)
     {
-        if (he_tri[i] == -1)
+        if (he_dead[i] || he_tri[i] == -1)
         {
             continue;
         }
@@ -1054,6 +1958,10 @@ void HalfEdgeMesh::check_invariants()
     // check if neighbours of triangle share at least 2 vertices with it
     for (int i = 0; i < n_tris; i++)
     {
+        if (tri_dead[i])
+        {
+            continue;
+        }
         int start_he = tri_he[i];
         int he = start_he;
         do
@@ -1,7 +1,9 @@
 #include <vector>
-#include <unordered_map>
 #include <set>
+#include <functional>
 #include "glm/glm.hpp"
+#include "edge_map.hpp"
+#include "sparse.hpp"
 #include "viewer.hpp"
 
 /*
@@ -21,10 +23,20 @@
  * whether to use indices or pointers, etc.
  */
 
+// How much each triangle around a vertex counts towards its normal.
+enum class NormalWeighting
+{
+    Liu,   // by area over the squared lengths of the two edges at the vertex (Liu 1999)
+    Angle, // by the angle at the vertex
+    Area,  // by area
+};
+
 class HalfEdgeMesh
 {
 
   public:
+    // The lengths of the arrays below. Deleting leaves dead elements in them (see
+    // delete_vert) until compact(), so these count those too.
     int n_verts, n_he, n_tris;
 
     std::vector<int> vert_he;
@@ -34,16 +46,69 @@ class HalfEdgeMesh
     std::vector<int> he_next;
     std::vector<int> he_pair;
     std::vector<int> he_tri;
-    std::unordered_map<uint64_t, int> he_map;
+    EdgeMap he_map; // (from, to) -> half-edge
+    // Follow direct writes with mark_moved for the vertices written, or
+    // positions_changed, or the cached corner weights go stale.
     std::vector<glm::vec3> vert_pos;
     std::vector<glm::vec3> vert_normal;
     std::vector<glm::vec3> vert_gravity;
+    // Per half-edge, for the triangle it belongs to: the cotangent of the angle
+    // across from it, and the share of the corner it leaves from in that
+    // vertex's mixed Voronoi area. Meaningless outside the boundary (he_tri -1),
+    // and only up to date after update_corner_weights.
+    std::vector<float> he_cot;
+    std::vector<float> he_area;
+
+    // Bumped by every change to the connectivity, so that what is derived from
+    // it can tell it is stale. Bump it after editing the arrays directly too.
+    int topology_version = 0;
+
+    // The neighbours of every vertex in compressed rows: those of v are
+    // verts[offsets[v]] up to verts[offsets[v + 1]], in get_adjacent_vertices order.
+    struct OneRing
+    {
+        std::vector<int> offsets;
+        std::vector<int> verts;
+        int version = -1; // the topology_version it was built for
+    };
+
+    // Where compact() moved every element: the new index by the old one, or -1
+    // for the dead ones.
+    struct Remap
+    {
+        std::vector<int> verts, he, tris;
+    };
+
+    // One level of a level_of_detail_chain: triangles indexing the vertices of
+    // the mesh it was built from, which it shares with all the other levels.
+    struct LevelOfDetail
+    {
+        float fraction; // of the mesh's triangles asked for
+        float error;    // the largest quadric error of the collapses that made it
+        std::vector<glm::ivec3> tris;
+    };
 
     void load_objfile(std::string &filename);
-    void recompute_vertex_normals();
+    // Stores the whole mesh, connectivity and edge index included, so that
+    // load_snapshot can restore it without parsing or building anything.
+    bool save_snapshot(const std::string &path) const;
+    bool load_snapshot(const std::string &path);
+    void recompute_vertex_normals(NormalWeighting weighting = NormalWeighting::Liu);
+    // Recomputes only the normals that depend on the positions of the moved vertices.
+    void update_vertex_normals(const std::vector<int> &moved, NormalWeighting weighting = NormalWeighting::Liu);
     std::vector<int> get_adjacent_vertices(int vertex);
+    const OneRing &one_ring(); // rebuilt if the topology changed since the last call
     void gaussian_smoothing(float lambda);
     void taubin_smoothing(float lambda, float mu, int n_iter);
+    // The cotangent Laplacian as a positive semi-definite matrix K, rows in
+    // one_ring order after the diagonal: K_uv = -(cot a + cot b) / 2 for the
+    // angles a and b across edge uv, and K_uu = -sum of K_uv. mass gets every
+    // vertex's mixed Voronoi area.
+    void cotangent_laplacian(SparseMatrix &K, std::vector<float> &mass);
+    // One implicit (backward Euler) step of time t of the cotangent Laplacian
+    // flow, stable however large t is. Details of size around sqrt(t) and below
+    // are smoothed out. Returns the number of solver iterations.
+    int implicit_smoothing(float t, int max_iter = 1000, float tolerance = 1e-5f);
     void set_vert_attribs(std::vector<glm::vec3> &vert_pos, std::vector<glm::vec3> &vert_normal);
     void set_faces(std::vector<glm::ivec3> &faces);
     void add_face(glm::ivec3 &face);
@@ -51,16 +116,67 @@ class HalfEdgeMesh
     bool v_in_tri(int tri, int vertex);
     int he_prev(int he);
     void check_invariants();
+    // Mark the element dead and free its index for reuse by later splits, in
+    // constant time; the rest of the mesh must no longer refer to it.
     void delete_vert(int vert);
     void delete_tri(int tri);
     void delete_he(int he);
+    // Removes the dead elements, renumbering the rest in order in one pass.
+    Remap compact();
     void edge_flip(int he);
-    void edge_split(int he);
+    int edge_split(int he); // returns the new vertex
     void edge_collapse(int he);
-    bool collapse_check(int he);
+    // Whether he can be collapsed, keeping the mesh manifold and, with check_geometry,
+    // without folding or squashing triangles when its ends meet at the midpoint.
+    bool collapse_check(int he, bool check_geometry = true);
+    // Whether collapsing he would leave an edge longer than max_length.
+    bool collapse_stretches(int he, float max_length);
     void remeshing(float l, float lambda);
+    // Isotropic remeshing towards edge length l from work lists: edges too long
+    // or short, or whose flip would even out valences, are queued by priority and
+    // only the edges around each change are queued again. Relaxes what changed
+    // (lambda as in remeshing) and repeats until nothing does or max_iter times.
+    // Returns the number of splits, collapses and flips.
+    int incremental_remeshing(float l, float lambda, int max_iter = 10);
     float he_length(int he);
     void assign_weights();
+    // Brings he_cot and he_area up to date, only around the vertices marked since
+    // the last update unless the whole mesh changed (set_faces, smoothing, ...).
+    void update_corner_weights();
+    // Marks the triangles around vert for update_corner_weights, e.g. after moving
+    // it. Edge flips, splits and collapses mark what they change themselves.
+    void mark_moved(int vert);
+    // Marks every corner weight for recomputing, after vert_pos was overwritten wholesale.
+    void positions_changed();
     bool flip_check(int he);
     bool split_check(int he);
+    // Collapses the edges that change the shape least, by quadric error, until
+    // about target_tris triangles are left (or no edge can go). Boundaries stay,
+    // and so, nearly, do edges between triangles more than feature_angle degrees
+    // apart. Compacts the mesh; returns the number of triangles left.
+    int simplify(int target_tris, float feature_angle = 60.0f);
+    // Simplifies a copy of the mesh to each fraction of its triangles in turn,
+    // in a single run, keeping the triangles at each. The vertices are left as
+    // they are, so a renderer can keep one vertex buffer and swap index buffers.
+    std::vector<LevelOfDetail> level_of_detail_chain(const std::vector<float> &fractions = {0.5f, 0.25f, 0.125f,
+                                                                                              0.0625f},
+                                                     float feature_angle = 60.0f) const;
+
+  private:
+    void update_triangle_weights(int tri);
+    // simplify down to each of targets (descending) in turn, calling reached
+    // with the error so far at each
+    void simplify_by_quadrics(const std::vector<int> &targets, float feature_angle,
+                              const std::function<void(double)> &reached);
+    // a dead element's index if there is one, else a new one at the end
+    int new_vert();
+    int new_he();
+    int new_tri();
+
+    std::vector<int> free_verts, free_he, free_tris; // dead elements, for reuse
+
+    std::vector<int> weights_dirty; // vertices marked since the last update_corner_weights
+    bool weights_stale = true;      // all the corner weights need recomputing
+    OneRing ring;
+    std::vector<glm::vec3> vert_pos_back; // smoothing writes here, then swaps it with vert_pos
 };
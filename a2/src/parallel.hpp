@@ -0,0 +1,33 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Splits [0, n) into chunks for parallel_chunks. The split only depends on n,
+// so two loops over the same range see the same chunks.
+inline int chunk_count(long n)
+{
+    long hw = std::max(1u, std::thread::hardware_concurrency());
+    return int(std::max(1L, std::min(hw, n / 65536)));
+}
+
+// Calls fn(chunk, begin, end) for each of the chunk_count(n) chunks of [0, n), each on its own thread.
+inline void parallel_chunks(long n, const std::function<void(int, long, long)> &fn)
+{
+    int chunks = chunk_count(n);
+    std::vector<std::thread> threads;
+    for (int c = 1; c < chunks; c++)
+    {
+        threads.emplace_back(fn, c, n * c / chunks, n * (c + 1) / chunks);
+    }
+    fn(0, 0, n / chunks);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+#endif
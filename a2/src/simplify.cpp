@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+#include "mesh.hpp"
+
+/*
+ * Quadric error metric simplification (Garland and Heckbert 1997). Every vertex
+ * keeps a quadric: the sum of the squared distances to the planes of the
+ * triangles around it, weighted by their areas. Collapsing an edge adds the
+ * quadrics of its ends, and costs the sum's value at the vertex that stays.
+ * The collapses are half-edge collapses, onto one of the two ends as it is,
+ * so the vertices left are always some of the original ones and every level
+ * of detail can index the same vertex array.
+ */
+
+// A symmetric 4x4 matrix Q, as its upper triangle, for v^T Q v with v = (x, y, z, 1).
+struct Quadric
+{
+    double q[10] = {}; // xx xy xz xw yy yz yw zz zw ww
+
+    // weight times the squared distance to the plane n.x + d = 0, |n| = 1
+    static Quadric plane(glm::vec3 n, double d, double weight)
+    {
+        Quadric p;
+        double v[4] = {n.x, n.y, n.z, d};
+        for (int i = 0, k = 0; i < 4; i++)
+        {
+            for (int j = i; j < 4; j++)
+            {
+                p.q[k++] = weight * v[i] * v[j];
+            }
+        }
+        return p;
+    }
+
+    Quadric &operator+=(const Quadric &other)
+    {
+        for (int k = 0; k < 10; k++)
+        {
+            q[k] += other.q[k];
+        }
+        return *this;
+    }
+
+    double error(glm::vec3 p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x + q[4] * y * y + 2 * q[5] * y * z +
+               2 * q[6] * y + q[7] * z * z + 2 * q[8] * z + q[9];
+    }
+};
+
+// A collapse of remove onto keep, waiting in the queue. It is stale once either
+// end has changed since (its stamp moved on) and is then skipped.
+struct Collapse
+{
+    double cost;
+    int keep, remove;
+    int keep_stamp, remove_stamp;
+    bool reversed; // the more expensive way, queued because the other folded
+
+    bool operator<(const Collapse &other) const
+    {
+        return cost > other.cost; // cheapest first
+    }
+};
+
+void HalfEdgeMesh::simplify_by_quadrics(const std::vector<int> &targets, float feature_angle,
+                                        const std::function<void(double)> &reached)
+{
+    // the unit normal and the area of a triangle, from its corners
+    auto plane_of = [&](int tri, glm::vec3 &normal, float &area) {
+        glm::ivec3 v = tri_verts[tri];
+        glm::vec3 n = glm::cross(vert_pos[v[1]] - vert_pos[v[0]], vert_pos[v[2]] - vert_pos[v[0]]);
+        area = glm::length(n) / 2;
+        normal = area > 0 ? n / (2 * area) : n;
+    };
+
+    std::vector<Quadric> quadrics(n_verts);
+    for (int tri = 0; tri < n_tris; tri++)
+    {
+        if (tri_he[tri] == -1)
+        {
+            continue;
+        }
+        glm::vec3 n;
+        float area;
+        plane_of(tri, n, area);
+        if (area == 0)
+        {
+            continue;
+        }
+        Quadric p = Quadric::plane(n, -glm::dot(n, vert_pos[tri_verts[tri][0]]), area);
+        for (int k = 0; k < 3; k++)
+        {
+            quadrics[tri_verts[tri][k]] += p;
+        }
+    }
+    // Edges between triangles more than feature_angle apart are features, kept
+    // like boundaries (which collapse_check never lets go): a vertex on a single
+    // line of them may only slide along it, and one where they meet or end, like
+    // a corner, stays.
+    const float feature_cos = std::cos(feature_angle * float(M_PI) / 180);
+    std::vector<char> sharp(n_he, false);
+    for (int he = 0; he < n_he; he++)
+    {
+        int pair = he_pair[he];
+        if (he_vert[he] == -1 || he > pair || he_tri[he] == -1 || he_tri[pair] == -1)
+        {
+            continue;
+        }
+        glm::vec3 n[2];
+        float area[2];
+        plane_of(he_tri[he], n[0], area[0]);
+        plane_of(he_tri[pair], n[1], area[1]);
+        sharp[he] = sharp[pair] = area[0] > 0 && area[1] > 0 && glm::dot(n[0], n[1]) < feature_cos;
+    }
+    std::vector<int> n_sharp(n_verts, 0);
+    auto count_sharp = [&](int v) {
+        n_sharp[v] = 0;
+        int out = vert_he[v];
+        do
+        {
+            n_sharp[v] += sharp[out];
+            out = he_next[he_pair[out]];
+        } while (out != vert_he[v]);
+    };
+    for (int v = 0; v < n_verts; v++)
+    {
+        if (vert_he[v] != -1)
+        {
+            count_sharp(v);
+        }
+    }
+    // whether remove may collapse onto the other end of edge he
+    auto may_remove = [&](int remove, int he) { return n_sharp[remove] == 0 || (n_sharp[remove] == 2 && sharp[he]); };
+
+    // the cheaper way to collapse edge he, onto either end
+    std::vector<int> stamp(n_verts, 0);
+    std::priority_queue<Collapse> queue;
+    auto consider = [&](int he) {
+        int a = he_vert[he], b = he_vert[he_pair[he]];
+        Quadric q = quadrics[a];
+        q += quadrics[b];
+        double cost_a = may_remove(b, he) ? q.error(vert_pos[a]) : HUGE_VAL;
+        double cost_b = may_remove(a, he) ? q.error(vert_pos[b]) : HUGE_VAL;
+        if (cost_a <= cost_b && cost_a != HUGE_VAL)
+        {
+            queue.push(Collapse{cost_a, a, b, stamp[a], stamp[b], false});
+        }
+        else if (cost_b != HUGE_VAL)
+        {
+            queue.push(Collapse{cost_b, b, a, stamp[b], stamp[a], false});
+        }
+    };
+    for (int he = 0; he < n_he; he++)
+    {
+        if (he_vert[he] != -1 && he < he_pair[he])
+        {
+            consider(he);
+        }
+    }
+
+    // whether moving remove onto keep turns any of its triangles over (or flat)
+    auto folds = [&](int remove, int keep) {
+        glm::vec3 from = vert_pos[remove], to = vert_pos[keep];
+        int he = vert_he[remove];
+        do
+        {
+            if (he_tri[he] != -1)
+            {
+                int x = he_vert[he_next[he]], y = he_vert[he_prev(he)];
+                if (x != keep && y != keep)
+                {
+                    glm::vec3 before = glm::cross(vert_pos[x] - from, vert_pos[y] - from);
+                    glm::vec3 after = glm::cross(vert_pos[x] - to, vert_pos[y] - to);
+                    if (glm::dot(before, after) <= 0)
+                    {
+                        return true;
+                    }
+                }
+            }
+            he = he_next[he_pair[he]];
+        } while (he != vert_he[remove]);
+        return false;
+    };
+
+    // Collapses turned down for folding or for the topology can become possible
+    // once the edges around them have changed, so they are tried again whenever
+    // the queue runs dry, for as long as that lets anything else collapse.
+    std::vector<Collapse> rejected;
+    bool collapsed = false; // since the last retry
+    int tris = n_tris - free_tris.size();
+    double error = 0;
+    size_t level = 0;
+    while (level < targets.size())
+    {
+        if (queue.empty() && collapsed)
+        {
+            for (const Collapse &c : rejected)
+            {
+                queue.push(c);
+            }
+            rejected.clear();
+            collapsed = false;
+        }
+        if (tris <= targets[level] || queue.empty())
+        {
+            reached(error);
+            level++;
+            continue;
+        }
+        Collapse c = queue.top();
+        queue.pop();
+        if (vert_he[c.keep] == -1 || vert_he[c.remove] == -1 || stamp[c.keep] != c.keep_stamp ||
+            stamp[c.remove] != c.remove_stamp)
+        {
+            continue;
+        }
+        int he = he_map.find(c.keep, c.remove);
+        if (he == -1 || !may_remove(c.remove, he))
+        {
+            continue;
+        }
+        // collapse_check's geometry is for a collapse to the midpoint, folds for this one
+        if (!collapse_check(he, false))
+        {
+            rejected.push_back(c);
+            continue;
+        }
+        if (folds(c.remove, c.keep))
+        {
+            // the other way round may not (and costs the same on flat parts)
+            if (!c.reversed && may_remove(c.keep, he))
+            {
+                Quadric q = quadrics[c.keep];
+                q += quadrics[c.remove];
+                queue.push(Collapse{q.error(vert_pos[c.remove]), c.remove, c.keep, c.remove_stamp, c.keep_stamp, true});
+            }
+            rejected.push_back(c);
+            continue;
+        }
+        // the edges from remove to the two vertices across he go, keep's stay
+        int across[2] = {he_vert[he_prev(he)], he_vert[he_prev(he_pair[he])]};
+        for (int v : across)
+        {
+            int from_keep = he_map.find(c.keep, v);
+            if (sharp[he_map.find(c.remove, v)])
+            {
+                sharp[from_keep] = sharp[he_pair[from_keep]] = true;
+            }
+        }
+        glm::vec3 pos = vert_pos[c.keep];
+        edge_collapse(he);
+        vert_pos[c.keep] = pos; // edge_collapse moves it to the midpoint
+        tris -= 2;
+        collapsed = true;
+        error = std::max(error, c.cost);
+        quadrics[c.keep] += quadrics[c.remove];
+        stamp[c.keep]++;
+        count_sharp(c.keep);
+        for (int v : across)
+        {
+            count_sharp(v);
+        }
+        int out = vert_he[c.keep];
+        do
+        {
+            consider(out);
+            out = he_next[he_pair[out]];
+        } while (out != vert_he[c.keep]);
+    }
+}
+
+int HalfEdgeMesh::simplify(int target_tris, float feature_angle)
+{
+    simplify_by_quadrics({target_tris}, feature_angle, [](double) {});
+    compact();
+    return n_tris;
+}
+
+std::vector<HalfEdgeMesh::LevelOfDetail> HalfEdgeMesh::level_of_detail_chain(const std::vector<float> &fractions,
+                                                                            float feature_angle) const
+{
+    std::vector<float> sorted = fractions;
+    std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+    int tris = n_tris - free_tris.size();
+    std::vector<int> targets;
+    for (float fraction : sorted)
+    {
+        targets.push_back(int(fraction * tris));
+    }
+
+    // Collapses only delete vertices and never move or renumber the others (as
+    // long as the copy isn't compacted), so every level indexes this mesh's.
+    HalfEdgeMesh work = *this;
+    std::vector<LevelOfDetail> levels;
+    work.simplify_by_quadrics(targets, feature_angle, [&](double error) {
+        LevelOfDetail lod;
+        lod.fraction = sorted[levels.size()];
+        lod.error = error;
+        for (int tri = 0; tri < work.n_tris; tri++)
+        {
+            if (work.tri_he[tri] != -1)
+            {
+                lod.tris.push_back(work.tri_verts[tri]);
+            }
+        }
+        levels.push_back(lod);
+    });
+    return levels;
+}
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mesh.hpp"
+
+/*
+ * A snapshot is a header followed by the mesh's arrays, each as raw bytes in
+ * the order of SNAPSHOT_ARRAYS and padded to a multiple of 8 bytes, then the
+ * table of the edge index. It is only meant to be read back on the same kind
+ * of machine (byte order and type sizes are not converted).
+ */
+
+#define SNAPSHOT_ARRAYS(X)                                                                                             \
+    X(vert_he) X(tri_he) X(tri_verts) X(he_vert) X(he_next) X(he_pair) X(he_tri) X(vert_pos) X(vert_normal)            \
+        X(vert_gravity) X(free_verts) X(free_he) X(free_tris)
+
+static const char snapshot_magic[8] = {'C', 'O', 'L', '7', '8', '1', 'H', 'E'};
+static const uint32_t snapshot_version = 2;
+
+#define COUNT_ARRAY(name) +1
+static const int snapshot_n_arrays = 0 SNAPSHOT_ARRAYS(COUNT_ARRAY);
+#undef COUNT_ARRAY
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t n_verts, n_he, n_tris;
+    uint64_t sizes[snapshot_n_arrays]; // elements in each array
+    uint64_t edge_capacity, edge_count;
+    uint64_t checksum; // of everything after the header
+};
+static_assert(sizeof(SnapshotHeader) % 8 == 0, "arrays must start 8-byte aligned");
+
+static uint64_t padded(uint64_t bytes)
+{
+    return (bytes + 7) & ~uint64_t(7);
+}
+
+// Whether the array sizes agree with the element counts the way check_invariants
+// expects, and the edge table is one EdgeMap can probe, so nothing is loaded past
+// the end of an array or the table.
+static bool header_consistent(const SnapshotHeader &header, size_t file_size)
+{
+    int i = 0;
+#define ARRAY_SIZE(name) uint64_t name = header.sizes[i++];
+    SNAPSHOT_ARRAYS(ARRAY_SIZE)
+#undef ARRAY_SIZE
+    uint64_t n_verts = header.n_verts, n_he = header.n_he, n_tris = header.n_tris;
+    if (header.n_verts < 0 || header.n_he < 0 || header.n_tris < 0)
+        return false;
+    if (vert_he != n_verts || vert_pos != n_verts || vert_normal > n_verts || vert_gravity > n_verts ||
+        free_verts > n_verts)
+        return false;
+    if (he_vert != n_he || he_next != n_he || he_pair != n_he || he_tri != n_he || free_he > n_he)
+        return false;
+    if (tri_he != n_tris || tri_verts != n_tris || free_tris > n_tris)
+        return false;
+    // a power of two (or empty), never more than half full, and no bigger than the file
+    uint64_t capacity = header.edge_capacity;
+    return (capacity & (capacity - 1)) == 0 && header.edge_count <= capacity / 2 &&
+           capacity <= file_size / sizeof(EdgeMap::Entry);
+}
+
+// FNV-1a over 8-byte words (a final partial word is padded with zeros, like the
+// arrays in the file), which keeps up with reading the file from the page cache.
+class Checksum
+{
+  public:
+    void add(const void *data, size_t bytes)
+    {
+        const char *p = (const char *)data;
+        for (size_t i = 0; i < bytes; i += 8)
+        {
+            uint64_t word = 0;
+            memcpy(&word, p + i, std::min<size_t>(8, bytes - i));
+            hash = (hash ^ word) * 0x100000001b3ull;
+        }
+    }
+
+    uint64_t value() const
+    {
+        return hash;
+    }
+
+  private:
+    uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+// A file mapped read-only into memory, or data = nullptr if it couldn't be.
+class MappedFile
+{
+  public:
+    MappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open())
+            return;
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                data = (const char *)map;
+                size = st.st_size;
+                // it is read front to back, once
+                madvise(map, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (data)
+            munmap((void *)data, size);
+#endif
+    }
+
+    const char *data = nullptr;
+    size_t size = 0;
+
+  private:
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+};
+
+bool HalfEdgeMesh::save_snapshot(const std::string &path) const
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open())
+    {
+        std::cerr << "Unable to open file: " << path << '\n';
+        return false;
+    }
+
+    // the edge table in its in-memory layout, but with the padding after each he zeroed so
+    // the checksum and the file don't depend on uninitialised bytes
+    const std::vector<EdgeMap::Entry> &table = he_map.table();
+    std::vector<char> edges(table.size() * sizeof(EdgeMap::Entry), 0);
+    for (size_t e = 0; e < table.size(); e++)
+    {
+        char *entry = edges.data() + e * sizeof(EdgeMap::Entry);
+        memcpy(entry + offsetof(EdgeMap::Entry, key), &table[e].key, sizeof(table[e].key));
+        memcpy(entry + offsetof(EdgeMap::Entry, he), &table[e].he, sizeof(table[e].he));
+    }
+    SnapshotHeader header = {};
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = snapshot_version;
+    header.n_verts = n_verts;
+    header.n_he = n_he;
+    header.n_tris = n_tris;
+    Checksum checksum;
+    int i = 0;
+#define ADD_ARRAY(name)                                                                                                \
+    header.sizes[i++] = name.size();                                                                                   \
+    checksum.add(name.data(), name.size() * sizeof(name[0]));
+    SNAPSHOT_ARRAYS(ADD_ARRAY)
+#undef ADD_ARRAY
+    header.edge_capacity = table.size();
+    header.edge_count = he_map.size();
+    checksum.add(edges.data(), edges.size());
+    header.checksum = checksum.value();
+
+    const char zeros[8] = {};
+    out.write((const char *)&header, sizeof(header));
+#define WRITE_ARRAY(name)                                                                                              \
+    out.write((const char *)name.data(), name.size() * sizeof(name[0]));                                               \
+    out.write(zeros, padded(name.size() * sizeof(name[0])) - name.size() * sizeof(name[0]));
+    SNAPSHOT_ARRAYS(WRITE_ARRAY)
+#undef WRITE_ARRAY
+    out.write(edges.data(), edges.size());
+    if (!out)
+    {
+        std::cerr << "Unable to write snapshot: " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool HalfEdgeMesh::load_snapshot(const std::string &path)
+{
+    MappedFile file(path);
+    if (!file.data)
+    {
+        std::cerr << "Unable to open file: " << path << '\n';
+        return false;
+    }
+    SnapshotHeader header;
+    if (file.size < sizeof(header))
+    {
+        std::cerr << path << " is not a mesh snapshot\n";
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header.version != snapshot_version)
+    {
+        std::cerr << path << " is not a mesh snapshot (or is from a different version)\n";
+        return false;
+    }
+    if (!header_consistent(header, file.size))
+    {
+        std::cerr << "Snapshot " << path << " is truncated or corrupt\n";
+        return false;
+    }
+
+    uint64_t bytes = 0;
+    int i = 0;
+#define ARRAY_BYTES(name) bytes += padded(header.sizes[i++] * sizeof(name[0]));
+    SNAPSHOT_ARRAYS(ARRAY_BYTES)
+#undef ARRAY_BYTES
+    bytes += header.edge_capacity * sizeof(EdgeMap::Entry);
+    const char *p = file.data + sizeof(header);
+    Checksum checksum;
+    if (file.size - sizeof(header) != bytes || (checksum.add(p, bytes), checksum.value() != header.checksum))
+    {
+        std::cerr << "Snapshot " << path << " is truncated or corrupt\n";
+        return false;
+    }
+
+    n_verts = header.n_verts;
+    n_he = header.n_he;
+    n_tris = header.n_tris;
+    topology_version++;
+    weights_stale = true;
+    i = 0;
+#define READ_ARRAY(name)                                                                                               \
+    name.assign((decltype(name.data()))p, (decltype(name.data()))p + header.sizes[i]);                                 \
+    p += padded(header.sizes[i++] * sizeof(name[0]));
+    SNAPSHOT_ARRAYS(READ_ARRAY)
+#undef READ_ARRAY
+    he_map.assign((const EdgeMap::Entry *)p, header.edge_capacity, header.edge_count);
+    return true;
+}
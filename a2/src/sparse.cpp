@@ -0,0 +1,156 @@
+#include <cmath>
+
+#include "parallel.hpp"
+#include "sparse.hpp"
+
+void SparseMatrix::multiply(const std::vector<glm::vec3> &x, std::vector<glm::vec3> &y) const
+{
+    y.resize(size());
+    parallel_chunks(size(), [&](int c, long begin, long end) {
+        for (long i = begin; i < end; i++)
+        {
+            glm::vec3 sum(.0f, .0f, .0f);
+            for (int k = row_start[i]; k < row_start[i + 1]; k++)
+            {
+                sum += val[k] * x[col[k]];
+            }
+            y[i] = sum;
+        }
+    });
+}
+
+// Sums of per-chunk partial sums, added in chunk order so the result doesn't
+// depend on which thread finishes first.
+static glm::dvec3 total(const std::vector<glm::dvec3> &partial)
+{
+    glm::dvec3 sum(0.0, 0.0, 0.0);
+    for (const glm::dvec3 &p : partial)
+    {
+        sum += p;
+    }
+    return sum;
+}
+
+int solve_pcg(const SparseMatrix &A, const std::vector<glm::vec3> &b, std::vector<glm::vec3> &x, int max_iter,
+              float tolerance)
+{
+    // The vectors are kept in doubles: in floats, the residual stalls well
+    // above useful tolerances on meshes far from the origin.
+    long n = A.size();
+    int chunks = chunk_count(n);
+    std::vector<double> inv_diag(n, 1.0);
+    std::vector<glm::dvec3> X(n), r(n), z(n), p(n), Ap(n);
+    parallel_chunks(n, [&](int c, long begin, long end) {
+        for (long i = begin; i < end; i++)
+        {
+            for (int k = A.row_start[i]; k < A.row_start[i + 1]; k++)
+            {
+                if (A.col[k] == i && A.val[k] != 0)
+                {
+                    inv_diag[i] = 1.0 / A.val[k];
+                }
+            }
+            X[i] = glm::dvec3(x[i]);
+        }
+    });
+
+    // y = A v, and the per-coordinate dot product of v and y
+    std::vector<glm::dvec3> partial(chunks), partial_rz(chunks), partial_bb(chunks);
+    auto multiply = [&](const std::vector<glm::dvec3> &v, std::vector<glm::dvec3> &y) {
+        parallel_chunks(n, [&](int c, long begin, long end) {
+            glm::dvec3 vy(0.0, 0.0, 0.0);
+            for (long i = begin; i < end; i++)
+            {
+                glm::dvec3 sum(0.0, 0.0, 0.0);
+                for (int k = A.row_start[i]; k < A.row_start[i + 1]; k++)
+                {
+                    sum += double(A.val[k]) * v[A.col[k]];
+                }
+                y[i] = sum;
+                vy += v[i] * sum;
+            }
+            partial[c] = vy;
+        });
+        return total(partial);
+    };
+
+    // r = b - A x, z = r / diag, p = z. Returns r . r, the true residual, which
+    // is checked again this way once the updated r says CG converged: rounding
+    // makes the two drift apart, and CG then starts over from x.
+    glm::dvec3 rz;
+    auto restart = [&]() {
+        multiply(X, r);
+        parallel_chunks(n, [&](int c, long begin, long end) {
+            glm::dvec3 rz(0.0, 0.0, 0.0), rr(0.0, 0.0, 0.0), bb(0.0, 0.0, 0.0);
+            for (long i = begin; i < end; i++)
+            {
+                glm::dvec3 bi(b[i]);
+                r[i] = bi - r[i];
+                z[i] = r[i] * inv_diag[i];
+                p[i] = z[i];
+                rz += r[i] * z[i];
+                rr += r[i] * r[i];
+                bb += bi * bi;
+            }
+            partial_rz[c] = rz;
+            partial[c] = rr;
+            partial_bb[c] = bb;
+        });
+        rz = total(partial_rz);
+        return total(partial);
+    };
+    glm::dvec3 rr = restart();
+    glm::dvec3 goal = double(tolerance) * double(tolerance) * total(partial_bb);
+
+    int iter = 0;
+    while (!(rr.x <= goal.x && rr.y <= goal.y && rr.z <= goal.z) && iter < max_iter)
+    {
+        iter++;
+        glm::dvec3 pAp = multiply(p, Ap), alpha;
+        for (int d = 0; d < 3; d++)
+        {
+            alpha[d] = pAp[d] > 0 ? rz[d] / pAp[d] : 0.0;
+        }
+
+        // step, and the new residual
+        parallel_chunks(n, [&](int c, long begin, long end) {
+            glm::dvec3 rz(0.0, 0.0, 0.0), rr(0.0, 0.0, 0.0);
+            for (long i = begin; i < end; i++)
+            {
+                X[i] += alpha * p[i];
+                r[i] -= alpha * Ap[i];
+                z[i] = r[i] * inv_diag[i];
+                rz += r[i] * z[i];
+                rr += r[i] * r[i];
+            }
+            partial_rz[c] = rz;
+            partial[c] = rr;
+        });
+        glm::dvec3 rz_new = total(partial_rz);
+        rr = total(partial);
+        if (rr.x <= goal.x && rr.y <= goal.y && rr.z <= goal.z)
+        {
+            rr = restart();
+            continue;
+        }
+        glm::dvec3 beta;
+        for (int d = 0; d < 3; d++)
+        {
+            beta[d] = rz[d] > 0 ? rz_new[d] / rz[d] : 0.0;
+        }
+        rz = rz_new;
+
+        parallel_chunks(n, [&](int c, long begin, long end) {
+            for (long i = begin; i < end; i++)
+            {
+                p[i] = z[i] + beta * p[i];
+            }
+        });
+    }
+
+    for (long i = 0; i < n; i++)
+    {
+        x[i] = glm::vec3(X[i]);
+    }
+    return iter;
+}
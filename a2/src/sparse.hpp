@@ -0,0 +1,36 @@
+#ifndef SPARSE_HPP
+#define SPARSE_HPP
+
+#include <vector>
+#include "glm/glm.hpp"
+
+/*
+ * A square sparse matrix in compressed rows: row i has the entries
+ * val[k] at column col[k] for k from row_start[i] up to row_start[i + 1].
+ * It multiplies vectors of vec3, i.e. the x, y and z columns at once, since
+ * everything it is used for acts on vertex positions.
+ */
+struct SparseMatrix
+{
+    std::vector<int> row_start;
+    std::vector<int> col;
+    std::vector<float> val;
+
+    int size() const
+    {
+        return int(row_start.size()) - 1;
+    }
+
+    // y = this * x, rows split across threads.
+    void multiply(const std::vector<glm::vec3> &x, std::vector<glm::vec3> &y) const;
+};
+
+// Solves A x = b for a symmetric positive definite A by conjugate gradients with
+// a Jacobi (diagonal) preconditioner, x, y and z separately but in the same sweeps.
+// x is the initial guess. Stops once every coordinate's residual is within
+// tolerance times its right hand side, or after max_iter iterations. Returns the
+// number of iterations.
+int solve_pcg(const SparseMatrix &A, const std::vector<glm::vec3> &b, std::vector<glm::vec3> &x, int max_iter,
+              float tolerance);
+
+#endif
@@ -54,9 +54,9 @@ int main(int argc, char** argv)
     //     std::cout << he << "\n";
     //     he = mesh.he_next[he];
     // }
-    // mesh.edge_split(mesh.he_map[(uint64_t(1) << 32) | 2]);
+    // mesh.edge_split(mesh.he_map.find(1, 2));
     // mesh.edge_collapse(27);
-    // mesh.edge_flip(mesh.he_map[(uint64_t(6) << 32) | 7]);
+    // mesh.edge_flip(mesh.he_map.find(6, 7));
 
     // l = 0;
     // for (int i = 0; i < mesh.n_he; i++)
@@ -74,8 +74,8 @@ int main(int argc, char** argv)
     // l /= mesh.n_he;
     // mesh.remeshing(l - 0.02, 0.33);
     // mesh.edge_flip(27);
-    // mesh.edge_collapse(mesh.he_map[(uint64_t(1) << 32) | 2]);
-    // std::cout << mesh.flip_check(mesh.he_map[(uint64_t(10) << 32) | 13]) << "\n";
+    // mesh.edge_collapse(mesh.he_map.find(1, 2));
+    // std::cout << mesh.flip_check(mesh.he_map.find(10, 13)) << "\n";
 
     // float l = 0;
     // for (int i = 0; i < mesh.n_he; i++)
@@ -0,0 +1,313 @@
+#ifndef CORE_BLEND_HPP
+#define CORE_BLEND_HPP
+
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace COL781
+{
+namespace Core
+{
+
+    /* Blending of packed 8-bit premultiplied-alpha pixels in 8.8 fixed point.
+
+       Pixels are 32-bit words with one byte per channel. The formulas treat all
+       channels alike except for alpha, whose position is given as the bit shift
+       of its byte (SDL_PixelFormat::Ashift), so any RGBA byte order works.
+       Results are exactly rounded, x*y/255 being computed as
+       (t + (t >> 8)) >> 8 with t = x*y + 128. */
+    enum class BlendMode
+    {
+        Source,     // d = s
+        SourceOver, // d = s + d(1 - sa)
+        Add,        // d = min(1, s + d)
+        Multiply,   // d = sd + s(1 - da) + d(1 - sa)
+        Screen,     // d = s + d - sd = s + d(1 - s)
+    };
+
+    inline uint32_t mul255(uint32_t x, uint32_t y)
+    {
+        uint32_t t = x * y + 128;
+        return (t + (t >> 8)) >> 8;
+    }
+
+    // Straight to premultiplied alpha.
+    inline uint32_t premultiply(uint32_t pixel, int alpha_shift)
+    {
+        uint32_t a = (pixel >> alpha_shift) & 0xFF, out = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t c = (pixel >> shift) & 0xFF;
+            out |= (shift == alpha_shift ? a : mul255(c, a)) << shift;
+        }
+        return out;
+    }
+
+    // Every channel of a premultiplied pixel scaled by m / 255, e.g. a coverage value.
+    inline uint32_t scale(uint32_t pixel, uint32_t m)
+    {
+        return (mul255(pixel & 0xFF, m)) | (mul255((pixel >> 8) & 0xFF, m) << 8) |
+               (mul255((pixel >> 16) & 0xFF, m) << 16) | (mul255(pixel >> 24, m) << 24);
+    }
+
+    template <BlendMode mode> inline uint32_t blend(uint32_t src, uint32_t dst, int alpha_shift)
+    {
+        uint32_t sa = (src >> alpha_shift) & 0xFF, da = (dst >> alpha_shift) & 0xFF, out = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF, c;
+            switch (mode)
+            {
+            case BlendMode::Source:
+                c = s;
+                break;
+            case BlendMode::SourceOver:
+                c = s + mul255(d, 255 - sa);
+                break;
+            case BlendMode::Add:
+                c = s + d;
+                break;
+            case BlendMode::Multiply:
+                c = mul255(s, d) + mul255(s, 255 - da) + mul255(d, 255 - sa);
+                break;
+            case BlendMode::Screen:
+            default:
+                c = s + mul255(d, 255 - s);
+                break;
+            }
+            out |= (c > 255 ? 255 : c) << shift;
+        }
+        return out;
+    }
+
+#if defined(__SSE2__)
+    namespace simd
+    {
+        // x*y/255 on 16-bit lanes holding bytes
+        inline __m128i mul255(__m128i x, __m128i y)
+        {
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+            return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        }
+
+        // x*y/255 on bytes, 16 at a time
+        inline __m128i mul255_u8(__m128i x, __m128i y)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i lo = mul255(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero));
+            __m128i hi = mul255(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero));
+            return _mm_packus_epi16(lo, hi);
+        }
+
+        // 255 - the alpha byte of each pixel, copied into all four of its bytes
+        inline __m128i inverseAlpha(__m128i px, __m128i alpha_shift)
+        {
+            __m128i a = _mm_and_si128(_mm_srl_epi32(px, alpha_shift), _mm_set1_epi32(0xFF));
+            a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+            return _mm_xor_si128(_mm_or_si128(a, _mm_slli_epi32(a, 16)), _mm_set1_epi32(-1));
+        }
+
+        // 4 pixels
+        template <BlendMode mode> inline __m128i blend(__m128i s, __m128i d, __m128i alpha_shift)
+        {
+            switch (mode)
+            {
+            case BlendMode::Source:
+                return s;
+            case BlendMode::SourceOver:
+                return _mm_adds_epu8(s, mul255_u8(d, inverseAlpha(s, alpha_shift)));
+            case BlendMode::Add:
+                return _mm_adds_epu8(s, d);
+            case BlendMode::Multiply:
+                return _mm_adds_epu8(_mm_adds_epu8(mul255_u8(s, d), mul255_u8(s, inverseAlpha(d, alpha_shift))),
+                                     mul255_u8(d, inverseAlpha(s, alpha_shift)));
+            case BlendMode::Screen:
+            default:
+                return _mm_adds_epu8(s, mul255_u8(d, _mm_xor_si128(s, _mm_set1_epi32(-1))));
+            }
+        }
+    } // namespace simd
+#elif defined(__ARM_NEON)
+    namespace simd
+    {
+        // x*y/255 on 16 bytes
+        inline uint8x16_t mul255(uint8x16_t x, uint8x16_t y)
+        {
+            uint16x8_t lo = vmull_u8(vget_low_u8(x), vget_low_u8(y));
+            uint16x8_t hi = vmull_u8(vget_high_u8(x), vget_high_u8(y));
+            return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)), vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+        }
+
+        // one channel of 16 pixels
+        template <BlendMode mode> inline uint8x16_t blend(uint8x16_t s, uint8x16_t d, uint8x16_t sa, uint8x16_t da)
+        {
+            switch (mode)
+            {
+            case BlendMode::Source:
+                return s;
+            case BlendMode::SourceOver:
+                return vqaddq_u8(s, mul255(d, vmvnq_u8(sa)));
+            case BlendMode::Add:
+                return vqaddq_u8(s, d);
+            case BlendMode::Multiply:
+                return vqaddq_u8(vqaddq_u8(mul255(s, d), mul255(s, vmvnq_u8(da))), mul255(d, vmvnq_u8(sa)));
+            case BlendMode::Screen:
+            default:
+                return vqaddq_u8(s, mul255(d, vmvnq_u8(s)));
+            }
+        }
+    } // namespace simd
+#endif
+
+    // dst[i] = blend(src[i], dst[i]) for n pixels.
+    template <BlendMode mode> void blend(const uint32_t *src, uint32_t *dst, int n, int alpha_shift)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128i shift = _mm_cvtsi32_si128(alpha_shift);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i *)(src + i)), d = _mm_loadu_si128((const __m128i *)(dst + i));
+            _mm_storeu_si128((__m128i *)(dst + i), simd::blend<mode>(s, d, shift));
+        }
+#elif defined(__ARM_NEON)
+        const int a = alpha_shift / 8;
+        for (; i + 16 <= n; i += 16)
+        {
+            // deinterleaved, one vector per byte of the pixel
+            uint8x16x4_t s = vld4q_u8((const uint8_t *)(src + i)), d = vld4q_u8((const uint8_t *)(dst + i));
+            uint8x16_t sa = s.val[a], da = d.val[a];
+            for (int c = 0; c < 4; c++)
+            {
+                d.val[c] = simd::blend<mode>(s.val[c], d.val[c], sa, da);
+            }
+            vst4q_u8((uint8_t *)(dst + i), d);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            dst[i] = blend<mode>(src[i], dst[i], alpha_shift);
+        }
+    }
+
+    // dst[i] = blend(color scaled by mask[i] / 255, dst[i]), for drawing a solid premultiplied
+    // color through a coverage mask. Pixels with zero coverage are left alone (all modes but
+    // Source leave them alone anyway, as the scaled color is then zero).
+    template <BlendMode mode> void blendMasked(uint32_t color, const uint8_t *mask, uint32_t *dst, int n, int alpha_shift)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        const __m128i shift = _mm_cvtsi32_si128(alpha_shift), zero = _mm_setzero_si128();
+        const __m128i c = _mm_set1_epi32(color);
+        for (; i + 4 <= n; i += 4)
+        {
+            uint32_t m4;
+            memcpy(&m4, mask + i, 4);
+            if (m4 == 0)
+                continue;
+            // each mask byte spread over the four bytes of its pixel
+            __m128i m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m4), _mm_cvtsi32_si128(m4));
+            m = _mm_unpacklo_epi16(m, m);
+            __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+            __m128i out = simd::blend<mode>(simd::mul255_u8(c, m), d, shift);
+            if (mode == BlendMode::Source)
+            {
+                __m128i skip = _mm_cmpeq_epi32(m, zero);
+                out = _mm_or_si128(_mm_and_si128(skip, d), _mm_andnot_si128(skip, out));
+            }
+            _mm_storeu_si128((__m128i *)(dst + i), out);
+        }
+#elif defined(__ARM_NEON)
+        const int a = alpha_shift / 8;
+        uint8x16x4_t c;
+        for (int k = 0; k < 4; k++)
+        {
+            c.val[k] = vdupq_n_u8((color >> (8 * k)) & 0xFF);
+        }
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t m = vld1q_u8(mask + i);
+            uint8x16x4_t d = vld4q_u8((const uint8_t *)(dst + i)), s;
+            for (int k = 0; k < 4; k++)
+            {
+                s.val[k] = simd::mul255(c.val[k], m);
+            }
+            uint8x16_t sa = s.val[a], da = d.val[a], skip = vceqq_u8(m, vdupq_n_u8(0));
+            for (int k = 0; k < 4; k++)
+            {
+                d.val[k] = vbslq_u8(skip, d.val[k], simd::blend<mode>(s.val[k], d.val[k], sa, da));
+            }
+            vst4q_u8((uint8_t *)(dst + i), d);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            if (mask[i] != 0)
+                dst[i] = blend<mode>(scale(color, mask[i]), dst[i], alpha_shift);
+        }
+    }
+
+    // The same with the mode chosen at run time.
+    inline uint32_t blend(BlendMode mode, uint32_t src, uint32_t dst, int alpha_shift)
+    {
+        switch (mode)
+        {
+        case BlendMode::Source:
+            return blend<BlendMode::Source>(src, dst, alpha_shift);
+        case BlendMode::SourceOver:
+            return blend<BlendMode::SourceOver>(src, dst, alpha_shift);
+        case BlendMode::Add:
+            return blend<BlendMode::Add>(src, dst, alpha_shift);
+        case BlendMode::Multiply:
+            return blend<BlendMode::Multiply>(src, dst, alpha_shift);
+        case BlendMode::Screen:
+        default:
+            return blend<BlendMode::Screen>(src, dst, alpha_shift);
+        }
+    }
+
+    inline void blend(BlendMode mode, const uint32_t *src, uint32_t *dst, int n, int alpha_shift)
+    {
+        switch (mode)
+        {
+        case BlendMode::Source:
+            return blend<BlendMode::Source>(src, dst, n, alpha_shift);
+        case BlendMode::SourceOver:
+            return blend<BlendMode::SourceOver>(src, dst, n, alpha_shift);
+        case BlendMode::Add:
+            return blend<BlendMode::Add>(src, dst, n, alpha_shift);
+        case BlendMode::Multiply:
+            return blend<BlendMode::Multiply>(src, dst, n, alpha_shift);
+        case BlendMode::Screen:
+        default:
+            return blend<BlendMode::Screen>(src, dst, n, alpha_shift);
+        }
+    }
+
+    inline void blendMasked(BlendMode mode, uint32_t color, const uint8_t *mask, uint32_t *dst, int n, int alpha_shift)
+    {
+        switch (mode)
+        {
+        case BlendMode::Source:
+            return blendMasked<BlendMode::Source>(color, mask, dst, n, alpha_shift);
+        case BlendMode::SourceOver:
+            return blendMasked<BlendMode::SourceOver>(color, mask, dst, n, alpha_shift);
+        case BlendMode::Add:
+            return blendMasked<BlendMode::Add>(color, mask, dst, n, alpha_shift);
+        case BlendMode::Multiply:
+            return blendMasked<BlendMode::Multiply>(color, mask, dst, n, alpha_shift);
+        case BlendMode::Screen:
+        default:
+            return blendMasked<BlendMode::Screen>(color, mask, dst, n, alpha_shift);
+        }
+    }
+
+} // namespace Core
+} // namespace COL781
+
+#endif
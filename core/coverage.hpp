@@ -0,0 +1,171 @@
+#ifndef CORE_COVERAGE_HPP
+#define CORE_COVERAGE_HPP
+
+#include <cstdint>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace COL781
+{
+namespace Core
+{
+
+    const int max_samples = 16;
+
+    // Sample positions within a pixel, as offsets from its centre in pixels.
+    struct SamplePattern
+    {
+        int count = 0;
+        float dx[max_samples], dy[max_samples];
+
+        // Rotated-grid patterns for 1, 2, 4, 8 and 16 samples; other counts get the
+        // largest supported count below them.
+        static SamplePattern rotated(int samples)
+        {
+            // 4x is the pattern the rasterizers have always used, the others are the
+            // usual sparse grids on a 16x16 lattice
+            static const float p2[][2] = {{4, 4}, {-4, -4}};
+            static const float p4[][2] = {{4.8f, 3.2f}, {-3.2f, 4.8f}, {-4.8f, -3.2f}, {3.2f, -4.8f}};
+            static const float p8[][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5}, {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+            static const float p16[][2] = {{1, 1},   {-1, -3}, {-3, 2}, {4, -1}, {-5, -2}, {2, 5},  {5, 3},   {3, -5},
+                                           {-2, 6},  {0, -7},  {-4, -6}, {-6, 4}, {-8, 0}, {7, -4}, {6, 7},  {-7, -8}};
+            SamplePattern pattern;
+            pattern.count = samples >= 16 ? 16 : samples >= 8 ? 8 : samples >= 4 ? 4 : samples >= 2 ? 2 : 1;
+            if (pattern.count == 1)
+            {
+                pattern.dx[0] = pattern.dy[0] = 0;
+                return pattern;
+            }
+            const float(*p)[2] = pattern.count == 2 ? p2 : pattern.count == 4 ? p4 : pattern.count == 8 ? p8 : p16;
+            for (int i = 0; i < pattern.count; i++)
+            {
+                pattern.dx[i] = p[i][0] / 16;
+                pattern.dy[i] = p[i][1] / 16;
+            }
+            return pattern;
+        }
+
+        // Ordered (axis-aligned) grids of samples, e.g. 2x2 for 4 samples.
+        static SamplePattern ordered(int samples)
+        {
+            SamplePattern pattern;
+            pattern.count = samples >= 16 ? 16 : samples >= 8 ? 8 : samples >= 4 ? 4 : samples >= 2 ? 2 : 1;
+            int nx = pattern.count >= 8 ? 4 : pattern.count >= 2 ? 2 : 1, ny = pattern.count / nx;
+            for (int i = 0; i < pattern.count; i++)
+            {
+                pattern.dx[i] = (i % nx + 0.5f) / nx - 0.5f;
+                pattern.dy[i] = (i / nx + 0.5f) / ny - 0.5f;
+            }
+            return pattern;
+        }
+    };
+
+    struct Coverage
+    {
+        uint32_t mask;  // bit i set if sample i of the pattern is inside
+        float fraction; // covered samples / pattern size
+    };
+
+    inline int popcount(uint32_t mask)
+    {
+#if defined(__GNUC__)
+        return __builtin_popcount(mask);
+#else
+        int n = 0;
+        for (; mask; mask &= mask - 1)
+            n++;
+        return n;
+#endif
+    }
+
+    /* Multisample coverage of a triangle given by counter-clockwise vertices
+       (anything with .x and .y). Inside means on or to the left of every edge,
+       as with the scalar membership checks.
+
+       The edge functions are set up once per triangle, including their value at
+       each sample offset, so that a pixel costs three edge evaluations at its
+       centre plus one vector add and compare per edge for every four samples,
+       instead of three dot products per sample. */
+    class TriangleCoverage
+    {
+      public:
+        // pixel_w and pixel_h give the size of a pixel in the triangle's coordinates.
+        template <typename Vec>
+        TriangleCoverage(const Vec (&tri)[3], const SamplePattern &pattern, float pixel_w = 1, float pixel_h = 1)
+            : count(pattern.count), groups((pattern.count + 3) / 4),
+              full((1u << pattern.count) - 1)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                const Vec &v1 = tri[k], &v2 = tri[(k + 1) % 3];
+                // dot((-s.y, s.x), pt - v1) with s = v2 - v1
+                a[k] = -(v2.y - v1.y);
+                b[k] = v2.x - v1.x;
+                c[k] = -(a[k] * v1.x + b[k] * v1.y);
+                for (int i = 0; i < max_samples; i++)
+                {
+                    // padding lanes never pass, and are masked off anyway
+                    step[k][i] = i < count ? a[k] * pattern.dx[i] * pixel_w + b[k] * pattern.dy[i] * pixel_h : -1e30f;
+                }
+            }
+        }
+
+        // Coverage of the pixel centred at (x, y).
+        Coverage at(float x, float y) const
+        {
+            uint32_t mask = sampleMask(x, y);
+            return {mask, popcount(mask) / float(count)};
+        }
+
+        uint32_t sampleMask(float x, float y) const
+        {
+            float e0 = a[0] * x + b[0] * y + c[0];
+            float e1 = a[1] * x + b[1] * y + c[1];
+            float e2 = a[2] * x + b[2] * y + c[2];
+            uint32_t mask = 0;
+#if defined(__SSE2__)
+            const __m128 zero = _mm_setzero_ps();
+            __m128 v0 = _mm_set1_ps(e0), v1 = _mm_set1_ps(e1), v2 = _mm_set1_ps(e2);
+            for (int g = 0; g < groups; g++)
+            {
+                __m128 in = _mm_cmpge_ps(_mm_add_ps(v0, _mm_load_ps(step[0] + 4 * g)), zero);
+                in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(v1, _mm_load_ps(step[1] + 4 * g)), zero));
+                in = _mm_and_ps(in, _mm_cmpge_ps(_mm_add_ps(v2, _mm_load_ps(step[2] + 4 * g)), zero));
+                mask |= uint32_t(_mm_movemask_ps(in)) << (4 * g);
+            }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+            const float32x4_t zero = vdupq_n_f32(0.0f);
+            const uint32x4_t bits = {1, 2, 4, 8};
+            float32x4_t v0 = vdupq_n_f32(e0), v1 = vdupq_n_f32(e1), v2 = vdupq_n_f32(e2);
+            for (int g = 0; g < groups; g++)
+            {
+                uint32x4_t in = vcgeq_f32(vaddq_f32(v0, vld1q_f32(step[0] + 4 * g)), zero);
+                in = vandq_u32(in, vcgeq_f32(vaddq_f32(v1, vld1q_f32(step[1] + 4 * g)), zero));
+                in = vandq_u32(in, vcgeq_f32(vaddq_f32(v2, vld1q_f32(step[2] + 4 * g)), zero));
+                mask |= vaddvq_u32(vandq_u32(in, bits)) << (4 * g);
+            }
+#else
+            for (int i = 0; i < count; i++)
+            {
+                if (e0 + step[0][i] >= 0 && e1 + step[1][i] >= 0 && e2 + step[2][i] >= 0)
+                    mask |= 1u << i;
+            }
+#endif
+            return mask & full;
+        }
+
+      private:
+        int count, groups;
+        uint32_t full;
+        float a[3], b[3], c[3];
+        alignas(16) float step[3][max_samples];
+    };
+
+} // namespace Core
+} // namespace COL781
+
+#endif
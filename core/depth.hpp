@@ -0,0 +1,124 @@
+#ifndef CORE_DEPTH_HPP
+#define CORE_DEPTH_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace COL781
+{
+namespace Core
+{
+
+    enum class DepthFormat
+    {
+        Float32,         // NDC z as a float, nearer is smaller
+        Float32Reversed, // z / w of a reversedPerspective projection as a float, nearer is larger
+        Unorm16,         // (z + 1) / 2 in 16 bits, nearer is smaller
+    };
+
+    /* How a depth buffer format stores depth. For a vertex at clip position
+       clip, value(clip) is its depth, which interpolates linearly in screen
+       space once divided by w like any varying. store encodes an interpolated
+       depth, passes is the depth test (d is at least as near as stored), and
+       buffers are cleared to clearValue(), the farthest depth.
+
+       Float32Reversed needs a reversed-Z projection such as reversedPerspective,
+       whose depth is near / distance: 1 at the near plane, falling towards 0
+       far away, where floats are densest, so its relative precision hardly
+       changes with distance. With a standard projection its depth test is
+       backwards, and no format can do better than Float32 there: the far
+       range has already cancelled away in computing clip z. Unorm16 halves
+       the bytes per sample at the cost of precision. */
+    template <DepthFormat Format> struct Depth;
+
+    template <> struct Depth<DepthFormat::Float32>
+    {
+        typedef float Value;
+
+        static float value(glm::vec4 clip)
+        {
+            return clip.z / clip.w;
+        }
+        static Value store(float d)
+        {
+            return d;
+        }
+        static bool passes(Value d, Value stored)
+        {
+            return !(d > stored);
+        }
+        static Value clearValue()
+        {
+            return 1.0f;
+        }
+    };
+
+    template <> struct Depth<DepthFormat::Float32Reversed>
+    {
+        typedef float Value;
+
+        static float value(glm::vec4 clip)
+        {
+            return clip.z / clip.w;
+        }
+        static Value store(float d)
+        {
+            return d;
+        }
+        static bool passes(Value d, Value stored)
+        {
+            return !(d < stored);
+        }
+        static Value clearValue()
+        {
+            return 0.0f;
+        }
+    };
+
+    template <> struct Depth<DepthFormat::Unorm16>
+    {
+        typedef uint16_t Value;
+
+        static float value(glm::vec4 clip)
+        {
+            return (clip.z / clip.w + 1) * 0.5f;
+        }
+        static Value store(float d)
+        {
+            return Value(fminf(fmaxf(d, 0.0f), 1.0f) * 65535 + 0.5f);
+        }
+        static bool passes(Value d, Value stored)
+        {
+            return d <= stored;
+        }
+        static Value clearValue()
+        {
+            return 65535;
+        }
+    };
+
+    // A perspective projection like glm::perspective (fovy in radians) with its far plane
+    // at infinity, for Float32Reversed: clip z is the near distance, so depth is
+    // near / distance with no subtraction to cancel.
+    inline glm::mat4 reversedPerspective(float fovy, float aspect, float near)
+    {
+        float f = 1 / tanf(fovy / 2);
+        glm::mat4 m(0.0f);
+        m[0][0] = f / aspect;
+        m[1][1] = f;
+        m[2][3] = -1;
+        m[3][2] = near;
+        return m;
+    }
+
+    // Bytes per sample.
+    inline int depthBytes(DepthFormat format)
+    {
+        return format == DepthFormat::Unorm16 ? 2 : 4;
+    }
+
+} // namespace Core
+} // namespace COL781
+
+#endif
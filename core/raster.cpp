@@ -0,0 +1,224 @@
+#include "raster.hpp"
+#include <chrono>
+
+namespace COL781
+{
+namespace Core
+{
+
+    ////////////////////////////////////////////////////////////////////////////
+    /// ThreadPool
+    ////////////////////////////////////////////////////////////////////////////
+
+    ThreadPool::ThreadPool(size_t n_threads)
+        : n_threads(n_threads), threads(n_threads), alive(false), work(n_threads), next_job(0), n_jobs(0), fn(nullptr),
+          busy(n_threads + 1, 0)
+    {
+        start();
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        stop();
+    }
+
+    void ThreadPool::start()
+    {
+        if (alive)
+            return;
+        alive = true;
+        for (int i = 0; i < n_threads; i++)
+        {
+            // TODO CPU affinity - not so easy to set in a cross-platform manner.
+            // Especially hard (impossible?) to do on MacOS w/ arm processors
+            threads[i] = std::thread([this, i] { this->threadMain(i); });
+        }
+    }
+
+    void ThreadPool::stop()
+    {
+        if (!alive)
+            return;
+        alive = false;
+        for (int i = 0; i < n_threads; i++)
+        {
+            threads[i].join();
+        }
+    }
+
+    void ThreadPool::runJobs(int thread)
+    {
+        std::chrono::steady_clock::time_point tic = std::chrono::steady_clock::now();
+        int job;
+        while ((job = next_job++) < n_jobs)
+        {
+            (*fn)(thread, job);
+        }
+        busy[thread] += std::chrono::duration<double>(std::chrono::steady_clock::now() - tic).count();
+    }
+
+    void ThreadPool::threadMain(int thread)
+    {
+        while (alive)
+        {
+            if (!work[thread])
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            runJobs(thread);
+            // turn self off
+            work[thread] = false;
+        }
+    }
+
+    void ThreadPool::parallelFor(int n_jobs, const std::function<void(int, int)> &fn)
+    {
+        if (n_jobs <= 0)
+            return;
+        // all of work[i] guaranteed to be false here
+        this->fn = &fn;
+        this->n_jobs = n_jobs;
+        next_job = 0;
+        bool workers = alive;
+        if (workers)
+        {
+            for (int i = 0; i < n_threads; i++)
+            {
+                work[i] = true;
+            }
+        }
+
+        // help out instead of just spinning
+        runJobs(n_threads);
+
+        // see the work status
+        bool all_free = !workers;
+        while (!all_free)
+        {
+            all_free = true;
+            for (int i = 0; i < n_threads; i++)
+            {
+                all_free = all_free && !work[i];
+            }
+        }
+        this->fn = nullptr;
+    }
+
+    size_t ThreadPool::size() const
+    {
+        return n_threads;
+    }
+
+    double ThreadPool::busyTime(int thread) const
+    {
+        return busy[thread];
+    }
+
+    void ThreadPool::resetBusyTime()
+    {
+        std::fill(busy.begin(), busy.end(), 0);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    /// TileBinner
+    ////////////////////////////////////////////////////////////////////////////
+
+    TileBinner::TileBinner(int width, int height, int unit, int n_threads)
+        : tuner_(width, height, unit, n_threads), width(width), height(height)
+    {
+        layout();
+    }
+
+    void TileBinner::layout()
+    {
+        size = tuner_.tileSize();
+        tiles_x = (width + size - 1) / size;
+        tiles_y = (height + size - 1) / size;
+        bins.assign(tiles_x * tiles_y, std::vector<int>());
+    }
+
+    TileTuner &TileBinner::tuner()
+    {
+        return tuner_;
+    }
+
+    const TileTuner &TileBinner::tuner() const
+    {
+        return tuner_;
+    }
+
+    bool TileBinner::beginBatch()
+    {
+        if (tuner_.tileSize() == size)
+            return false;
+        layout();
+        return true;
+    }
+
+    int TileBinner::tileSize() const
+    {
+        return size;
+    }
+
+    int TileBinner::tilesX() const
+    {
+        return tiles_x;
+    }
+
+    int TileBinner::tilesY() const
+    {
+        return tiles_y;
+    }
+
+    int TileBinner::tileCount() const
+    {
+        return tiles_x * tiles_y;
+    }
+
+    void TileBinner::tileBounds(int t, glm::ivec2 &tl, glm::ivec2 &br) const
+    {
+        tl = glm::ivec2((t % tiles_x) * size, (t / tiles_x) * size);
+        br = glm::ivec2(tl.x + size - 1, tl.y + size - 1);
+    }
+
+    const std::vector<int> &TileBinner::bin(int t) const
+    {
+        return bins[t];
+    }
+
+    std::vector<int> TileBinner::tiles() const
+    {
+        std::vector<int> tiles;
+        for (int t = 0; t < bins.size(); t++)
+        {
+            if (!bins[t].empty())
+                tiles.push_back(t);
+        }
+        return tiles;
+    }
+
+    void TileBinner::render(ThreadPool &pool, const std::function<void(int, int, glm::ivec2, glm::ivec2)> &fn) const
+    {
+        std::vector<int> tiles = this->tiles();
+        pool.parallelFor(tiles.size(), [&](int thread, int job) {
+            glm::ivec2 tl, br;
+            tileBounds(tiles[job], tl, br);
+            fn(thread, tiles[job], tl, br);
+        });
+    }
+
+    bool TileBinner::endBatch()
+    {
+        for (size_t t = 0; t < bins.size(); t++)
+        {
+            bins[t].clear();
+        }
+        if (!tuner_.endBatch())
+            return false;
+        layout();
+        return true;
+    }
+
+} // namespace Core
+} // namespace COL781
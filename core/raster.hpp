@@ -0,0 +1,286 @@
+#ifndef CORE_RASTER_HPP
+#define CORE_RASTER_HPP
+
+#include "tiling.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace COL781
+{
+namespace Core
+{
+
+    /* The tiled rasterizer shared by a1's Software::Rasterizer and raster/'s
+       Rasterizer. A front end draws a batch of triangles in four stages:
+
+         setup        setupTriangle computes everything the later stages need
+                      of a triangle once, from its vertices in NDC (y up),
+         binning      TileBinner::add lists each triangle in every tile its
+                      bounding box overlaps, in submission order,
+         tile raster  TileBinner::render hands each non-empty tile to a single
+                      thread, which calls rasterizeBlock for the tile's bin,
+         shading      rasterizeBlock calls the front end's callback for every
+                      pixel centre the triangle covers.
+
+       Setup records are only read after binning, so the tile workers share
+       them without copies or locks.
+
+       Pixels are numbered bottom-up like NDC, so a front end storing rows
+       top-down writes row h - 1 - y. p is the size of half a pixel in NDC,
+       (1 / w, 1 / h). */
+
+    // Centre of pixel (x, y) in NDC.
+    inline glm::vec2 pixelCenter(int x, int y, glm::vec2 p)
+    {
+        return glm::vec2((2 * x + 1) * p.x - 1, (2 * y + 1) * p.y - 1);
+    }
+
+    // The pixel whose centre is nearest to pt.
+    inline glm::ivec2 nearestPixel(glm::vec2 pt, glm::vec2 p)
+    {
+        return glm::ivec2(std::round((pt.x + 1) / (2 * p.x) - 0.5f), std::round((pt.y + 1) / (2 * p.y) - 0.5f));
+    }
+
+    // f(pt) = a pt.x + b pt.y + c, over NDC.
+    struct Plane
+    {
+        float a, b, c;
+
+        float at(glm::vec2 pt) const
+        {
+            return a * pt.x + b * pt.y + c;
+        }
+    };
+
+    // What rasterizing a triangle needs, computed once and shared by all the tiles it is binned into.
+    struct TriangleSetup
+    {
+        glm::vec2 v[3];      // vertices in NDC
+        glm::vec2 normal[3]; // of edge k, from v[k] to v[k + 1]
+        float side[3];       // dot(normal[k], v[k + 2] - v[k]), the sign of the triangle's side of edge k
+        Plane bary[2];       // barycentric coordinates 1 and 2; coordinate 0 is 1 minus both
+        float area;          // twice the signed area, 0 if degenerate
+        glm::ivec2 lo, hi;   // pixel bounding box, grown by a pixel (may reach off screen)
+
+        // The plane taking the value f[k] at v[k], e.g. to interpolate depth linearly in screen space.
+        Plane interpolate(float f0, float f1, float f2) const
+        {
+            Plane f = {(f1 - f0) * bary[0].a + (f2 - f0) * bary[1].a, (f1 - f0) * bary[0].b + (f2 - f0) * bary[1].b,
+                       f0 + (f1 - f0) * bary[0].c + (f2 - f0) * bary[1].c};
+            return f;
+        }
+
+        // All three barycentric coordinates at pt. They are all >= 0 inside.
+        glm::vec3 barycentric(glm::vec2 pt) const
+        {
+            float t1 = bary[0].at(pt), t2 = bary[1].at(pt);
+            return glm::vec3(1 - t1 - t2, t1, t2);
+        }
+    };
+
+    // Sets up a triangle given by its vertices in NDC (anything with .x and .y) for a w x h framebuffer.
+    template <typename Vec> TriangleSetup setupTriangle(const Vec (&tri)[3], int w, int h)
+    {
+        TriangleSetup setup;
+        for (int k = 0; k < 3; k++)
+        {
+            setup.v[k] = glm::vec2(tri[k].x, tri[k].y);
+        }
+        const glm::vec2 *v = setup.v;
+        for (int k = 0; k < 3; k++)
+        {
+            glm::vec2 s = v[(k + 1) % 3] - v[k];
+            setup.normal[k] = glm::vec2(-s.y, s.x);
+            setup.side[k] = glm::dot(setup.normal[k], v[(k + 2) % 3] - v[k]);
+        }
+
+        setup.area = v[0].x * (v[1].y - v[2].y) + v[0].y * (v[2].x - v[1].x) + v[1].x * v[2].y - v[1].y * v[2].x;
+        float r = setup.area != 0 ? 1 / setup.area : 0;
+        Plane t1 = {(v[2].y - v[0].y) * r, (v[0].x - v[2].x) * r, (v[0].y * v[2].x - v[0].x * v[2].y) * r};
+        Plane t2 = {(v[0].y - v[1].y) * r, (v[1].x - v[0].x) * r, (v[0].x * v[1].y - v[0].y * v[1].x) * r};
+        setup.bary[0] = t1;
+        setup.bary[1] = t2;
+
+        glm::vec2 p(1.0f / w, 1.0f / h);
+        float xmin = fminf(v[0].x, fminf(v[1].x, v[2].x)), ymin = fminf(v[0].y, fminf(v[1].y, v[2].y));
+        float xmax = fmaxf(v[0].x, fmaxf(v[1].x, v[2].x)), ymax = fmaxf(v[0].y, fmaxf(v[1].y, v[2].y));
+        setup.lo = nearestPixel(glm::vec2(xmin - p.x, ymin - p.y), p);
+        setup.hi = nearestPixel(glm::vec2(xmax + p.x, ymax + p.y), p);
+        return setup;
+    }
+
+    // The square ignore test: true if, for some edge, all four corners of the rectangle
+    // [lo, hi] lie on the other side from the opposite vertex, so the triangle misses it.
+    inline bool outsideRect(const TriangleSetup &tri, glm::vec2 lo, glm::vec2 hi)
+    {
+        glm::vec2 corners[4] = {lo, glm::vec2(lo.x, hi.y), hi, glm::vec2(hi.x, lo.y)};
+        for (int k = 0; k < 3; k++)
+        {
+            bool outside = true;
+            for (int i = 0; i < 4 && outside; i++)
+            {
+                outside = glm::dot(corners[i] - tri.v[k], tri.normal[k]) * tri.side[k] < 0;
+            }
+            if (outside)
+                return true;
+        }
+        return false;
+    }
+
+    // Calls shade(x, y, pixel centre, barycentric coordinates) for every pixel of the block
+    // [tl, br], clipped to the w x h framebuffer, whose centre is inside the triangle. shade
+    // returns whether it wrote the pixel, and the number of pixels written is returned.
+    template <typename Shade>
+    long rasterizeBlock(const TriangleSetup &tri, glm::ivec2 tl, glm::ivec2 br, int w, int h, Shade &&shade)
+    {
+        if (tri.area == 0)
+            return 0;
+        glm::vec2 p(1.0f / w, 1.0f / h);
+        tl = glm::max(tl, tri.lo);
+        br = glm::min(br, tri.hi);
+        if (tl.x > br.x || tl.y > br.y || outsideRect(tri, pixelCenter(tl.x, tl.y, p), pixelCenter(br.x, br.y, p)))
+            return 0;
+
+        long samples = 0;
+        for (int y = std::max(0, tl.y); y <= std::min(h - 1, br.y); y++)
+        {
+            for (int x = std::max(0, tl.x); x <= std::min(w - 1, br.x); x++)
+            {
+                glm::vec2 pt = pixelCenter(x, y, p);
+                glm::vec3 b = tri.barycentric(pt);
+                if (!(b[0] >= 0 && b[1] >= 0 && b[2] >= 0))
+                    continue;
+                if (shade(x, y, pt, b))
+                    samples++;
+            }
+        }
+        return samples;
+    }
+
+    /* Worker threads that run parallel loops together with the calling thread.
+       The workers start with the pool and spin (yielding) between loops, so a
+       loop costs no wake-up latency. */
+    class ThreadPool
+    {
+      public:
+        ThreadPool(size_t n_threads);
+        ~ThreadPool();
+
+        // Starts the workers again after stop. Without them, loops run on the calling thread.
+        void start();
+        void stop();
+
+        // Calls fn(thread index, job index) for every job in [0, n_jobs) and
+        // blocks until all jobs are done. The calling thread helps out with
+        // thread index size(), so per-thread scratch needs size() + 1 slots.
+        void parallelFor(int n_jobs, const std::function<void(int, int)> &fn);
+
+        // Number of worker threads.
+        size_t size() const;
+
+        // Seconds thread index (up to size()) spent running jobs since the last reset.
+        double busyTime(int thread) const;
+        void resetBusyTime();
+
+      private:
+        void threadMain(int thread);
+        void runJobs(int thread);
+
+        size_t n_threads;
+        std::vector<std::thread> threads;
+        std::atomic<bool> alive;
+        std::vector<std::atomic<bool>> work; // set while worker i may still pick up jobs
+        std::atomic<int> next_job;
+        int n_jobs;
+        const std::function<void(int, int)> *fn;
+        std::vector<double> busy;
+    };
+
+    // Tiles [x0, x1] x [y0, y1] of the grid, empty if x0 > x1 or y0 > y1.
+    struct TileRange
+    {
+        int x0, y0, x1, y1;
+
+        bool empty() const
+        {
+            return x0 > x1 || y0 > y1;
+        }
+    };
+
+    /* Bins triangles into square tiles of a w x h framebuffer, sized by a
+       TileTuner. Triangles are numbered by the front end, which keeps whatever
+       it needs to draw them. Bins are emptied by endBatch. */
+    class TileBinner
+    {
+      public:
+        TileBinner(int width = 0, int height = 0, int unit = 1, int n_threads = 4);
+
+        TileTuner &tuner();
+        const TileTuner &tuner() const;
+
+        // Takes the tuner's tile size for the next batch (it changes with setFixed or
+        // calibrate). Returns true if the tile grid changed.
+        bool beginBatch();
+
+        // Bins triangle id into the tiles its bounding box overlaps and reports it
+        // to the tuner. Returns those tiles, empty if the triangle is off screen.
+        TileRange add(int id, const TriangleSetup &tri)
+        {
+            // before dividing, which would round a box just off the left or bottom
+            // edge into tile 0, and one just past the right or top into the last tile
+            if (tri.hi.x < 0 || tri.hi.y < 0 || tri.lo.x >= width || tri.lo.y >= height)
+                return TileRange{0, 0, -1, -1};
+            TileRange range = {std::max(0, tri.lo.x / size), std::max(0, tri.lo.y / size),
+                               std::min(tiles_x - 1, tri.hi.x / size), std::min(tiles_y - 1, tri.hi.y / size)};
+            if (range.empty())
+                return range;
+            tuner_.observeNdc(tri.v, std::min(width - 1, tri.hi.x) - std::max(0, tri.lo.x) + 1,
+                              std::min(height - 1, tri.hi.y) - std::max(0, tri.lo.y) + 1,
+                              (range.x1 - range.x0 + 1) * (range.y1 - range.y0 + 1));
+            for (int i = range.y0; i <= range.y1; i++)
+            {
+                for (int j = range.x0; j <= range.x1; j++)
+                    bins[i * tiles_x + j].push_back(id);
+            }
+            return range;
+        }
+
+        int tileSize() const;
+        int tilesX() const;
+        int tilesY() const;
+        int tileCount() const;
+
+        // Pixel bounds of tile t, inclusive. They reach past the framebuffer at its right and top edges.
+        void tileBounds(int t, glm::ivec2 &tl, glm::ivec2 &br) const;
+
+        // The triangles binned into tile t, in the order they were added.
+        const std::vector<int> &bin(int t) const;
+
+        // The tiles with anything binned, in index order.
+        std::vector<int> tiles() const;
+
+        // Calls fn(thread index, tile, tl, br) for every non-empty tile, each tile on a single thread.
+        void render(ThreadPool &pool, const std::function<void(int, int, glm::ivec2, glm::ivec2)> &fn) const;
+
+        // Empties the bins and lets the tuner adapt. Returns true if the tile grid changed,
+        // in which case anything the front end keeps per tile must be laid out again.
+        bool endBatch();
+
+      private:
+        void layout();
+
+        TileTuner tuner_;
+        int width, height;
+        int size, tiles_x, tiles_y;
+        std::vector<std::vector<int>> bins;
+    };
+
+} // namespace Core
+} // namespace COL781
+
+#endif
@@ -0,0 +1,281 @@
+#include "terminal.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+namespace COL781
+{
+namespace Core
+{
+
+    const char *const upper_half = "▀", *const lower_half = "▄", *const full_block = "█";
+    const int block_bytes = 3; // each of the above in UTF-8
+
+    static int digits(int n)
+    {
+        int d = 1;
+        for (; n >= 10; n /= 10)
+            d++;
+        return d;
+    }
+
+    TerminalDisplay::TerminalDisplay(int columns, int rows, std::ostream &out) : out(out), cols(columns), rows_(rows)
+    {
+    }
+
+    TerminalDisplay::~TerminalDisplay()
+    {
+        end();
+    }
+
+    void TerminalDisplay::resize(int width, int height)
+    {
+        // a cell is about twice as tall as wide, i.e. two square pixels
+        if (cols <= 0 && rows_ <= 0)
+            cols = std::min(width, 120);
+        if (cols <= 0)
+            cols = std::max(1, int(long(rows_) * 2 * width / height));
+        if (rows_ <= 0)
+            rows_ = std::max(1, int(long(cols) * height / width / 2));
+        shown.assign(cols * rows_, Cell{0, 0});
+        next.assign(cols * rows_, Cell{0, 0});
+        valid = false;
+    }
+
+    void TerminalDisplay::present(const uint32_t *pixels, int width, int height, int pitch, int r_shift, int g_shift,
+                                  int b_shift)
+    {
+        if (shown.empty())
+            resize(width, height);
+
+        // box filter down to cols x (2 rows) pixels
+        int h2 = 2 * rows_;
+        for (int y = 0; y < h2; y++)
+        {
+            int y0 = long(y) * height / h2, y1 = std::max(y0 + 1, int(long(y + 1) * height / h2));
+            for (int x = 0; x < cols; x++)
+            {
+                int x0 = long(x) * width / cols, x1 = std::max(x0 + 1, int(long(x + 1) * width / cols));
+                uint32_t sum[3] = {0, 0, 0};
+                for (int i = y0; i < y1; i++)
+                {
+                    const uint32_t *row = pixels + long(i) * pitch;
+                    for (int j = x0; j < x1; j++)
+                    {
+                        sum[0] += (row[j] >> r_shift) & 0xFF;
+                        sum[1] += (row[j] >> g_shift) & 0xFF;
+                        sum[2] += (row[j] >> b_shift) & 0xFF;
+                    }
+                }
+                uint32_t n = (y1 - y0) * (x1 - x0);
+                uint32_t rgb = (sum[0] / n) << 16 | (sum[1] / n) << 8 | sum[2] / n;
+                Cell &cell = next[(y / 2) * cols + x];
+                (y % 2 == 0 ? cell.top : cell.bottom) = rgb;
+            }
+        }
+
+        buf.clear();
+        if (!started)
+        {
+            buf += "\x1b[?25l\x1b[2J"; // hide the cursor, clear the screen
+            started = true;
+            cur_row = cur_col = -1;
+            cur_fg = cur_bg = -1;
+        }
+        size_t header = buf.size();
+        buf += "\x1b[?2026h"; // begin synchronized update
+        size_t body = buf.size();
+
+        long cells = 0;
+        for (int r = 0; r < rows_; r++)
+        {
+            int c = 0;
+            while (c < cols)
+            {
+                int i = r * cols + c;
+                if (valid && !changed(next[i], shown[i]))
+                {
+                    c++;
+                    continue;
+                }
+                if (cur_row == r && cur_col >= 0 && cur_col < c)
+                {
+                    // redraw the unchanged cells in between if that is shorter than skipping them
+                    int gap = c - cur_col, skip = gap == 1 ? 3 : 3 + digits(gap), redraw = 0;
+                    for (int k = cur_col; k < c && redraw < skip; k++)
+                        redraw += cellCost(shown[r * cols + k]);
+                    if (redraw < skip)
+                    {
+                        for (int k = cur_col; k < c; k++)
+                            drawCell(shown[r * cols + k]);
+                    }
+                }
+                moveTo(r, c);
+                drawCell(next[i]);
+                shown[i] = next[i];
+                cells++;
+                c++;
+            }
+        }
+        valid = true;
+
+        if (buf.size() == body)
+            buf.resize(header); // nothing changed
+        else
+            buf += "\x1b[?2026l";
+        if (!buf.empty())
+        {
+            out.write(buf.data(), buf.size());
+            out.flush();
+        }
+        stats_.frames++;
+        stats_.last_bytes = buf.size();
+        stats_.bytes += buf.size();
+        stats_.last_cells = cells;
+        stats_.cells += cells;
+    }
+
+    bool TerminalDisplay::changed(const Cell &now, const Cell &shown) const
+    {
+        auto differs = [&](uint32_t a, uint32_t b) {
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                if (abs(int((a >> shift) & 0xFF) - int((b >> shift) & 0xFF)) > tolerance)
+                    return true;
+            }
+            return false;
+        };
+        return differs(now.top, shown.top) || differs(now.bottom, shown.bottom);
+    }
+
+    // Bytes drawCell would write for the cell in the current state.
+    int TerminalDisplay::cellCost(const Cell &cell) const
+    {
+        const int sgr = 2 + 17; // "\x1b[" + "38;2;255;255;255m", at most
+        if (cell.top == cell.bottom)
+            return cur_fg == cell.top ? block_bytes : cur_bg == cell.top ? 1 : 1 + sgr;
+        bool upper = cur_fg == cell.top || cur_bg == cell.bottom;
+        bool lower = cur_fg == cell.bottom || cur_bg == cell.top;
+        int misses = upper ? (cur_fg != cell.top) + (cur_bg != cell.bottom)
+                           : lower ? (cur_fg != cell.bottom) + (cur_bg != cell.top) : 2;
+        return block_bytes + (misses == 0 ? 0 : misses == 1 ? sgr : 2 * sgr);
+    }
+
+    void TerminalDisplay::moveTo(int row, int col)
+    {
+        if (cur_row == row && cur_col == col)
+            return;
+        std::string cup = "\x1b[" + std::to_string(row + 1) + ";" + std::to_string(col + 1) + "H";
+        if (cur_row == row && cur_col >= 0 && cur_col < col)
+        {
+            // cursor forward
+            int n = col - cur_col;
+            std::string cuf = n == 1 ? "\x1b[C" : "\x1b[" + std::to_string(n) + "C";
+            buf += cuf.size() < cup.size() ? cuf : cup;
+        }
+        else if (col == 0 && cur_row >= 0 && cur_row + 1 == row)
+        {
+            buf += "\r\n";
+        }
+        else
+        {
+            buf += cup;
+        }
+        cur_row = row;
+        cur_col = col;
+    }
+
+    // Draws the cell at the cursor, picking the glyph that needs the fewest color changes.
+    void TerminalDisplay::drawCell(const Cell &cell)
+    {
+        if (cell.top == cell.bottom)
+        {
+            if (cur_fg == cell.top)
+            {
+                buf += full_block;
+            }
+            else
+            {
+                setColors(cur_fg, cell.top);
+                buf += ' ';
+            }
+        }
+        else if (cur_fg == cell.bottom || cur_bg == cell.top)
+        {
+            setColors(cell.bottom, cell.top);
+            buf += lower_half;
+        }
+        else
+        {
+            setColors(cell.top, cell.bottom);
+            buf += upper_half;
+        }
+        cur_col++;
+        if (cur_col == cols)
+        {
+            // terminals differ on where the cursor goes after the last column
+            cur_row = cur_col = -1;
+        }
+    }
+
+    void TerminalDisplay::setColors(int64_t fg, int64_t bg)
+    {
+        auto rgb = [](int64_t c) {
+            return std::to_string((c >> 16) & 0xFF) + ";" + std::to_string((c >> 8) & 0xFF) + ";" +
+                   std::to_string(c & 0xFF);
+        };
+        bool set_fg = fg != cur_fg && fg >= 0, set_bg = bg != cur_bg;
+        if (!set_fg && !set_bg)
+            return;
+        buf += "\x1b[";
+        if (set_fg)
+            buf += "38;2;" + rgb(fg);
+        if (set_fg && set_bg)
+            buf += ';';
+        if (set_bg)
+            buf += "48;2;" + rgb(bg);
+        buf += 'm';
+        if (set_fg)
+            cur_fg = fg;
+        cur_bg = bg;
+    }
+
+    void TerminalDisplay::setTolerance(int tolerance)
+    {
+        this->tolerance = tolerance;
+    }
+
+    void TerminalDisplay::invalidate()
+    {
+        valid = false;
+        cur_row = cur_col = -1;
+        cur_fg = cur_bg = -1;
+    }
+
+    void TerminalDisplay::end()
+    {
+        if (!started)
+            return;
+        buf = "\x1b[0m\x1b[" + std::to_string(rows_ + 1) + ";1H\x1b[?25h";
+        out.write(buf.data(), buf.size());
+        out.flush();
+        started = false;
+        valid = false;
+    }
+
+    int TerminalDisplay::columns() const
+    {
+        return cols;
+    }
+
+    int TerminalDisplay::rows() const
+    {
+        return rows_;
+    }
+
+    const TerminalStats &TerminalDisplay::stats() const
+    {
+        return stats_;
+    }
+
+} // namespace Core
+} // namespace COL781
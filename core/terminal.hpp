@@ -0,0 +1,85 @@
+#ifndef CORE_TERMINAL_HPP
+#define CORE_TERMINAL_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace COL781
+{
+namespace Core
+{
+
+    struct TerminalStats
+    {
+        long frames = 0;
+        long bytes = 0;      // written in total
+        long cells = 0;      // cells redrawn in total
+        long last_bytes = 0; // by the last frame
+        long last_cells = 0;
+    };
+
+    /* Shows frames in a truecolor terminal, two pixels per character cell (an
+       upper or lower half block with 24-bit foreground and background colors).
+
+       Only the cells that changed since the previous frame are written. Changed
+       cells are reached with the shortest cursor movement, runs of cells sharing
+       colors share one color escape, and short gaps of unchanged cells are
+       redrawn when that is cheaper than jumping over them. Each frame goes out
+       in a single write, wrapped in synchronized-update escapes where the
+       terminal supports them, so remote sessions see few bytes and no tearing. */
+    class TerminalDisplay
+    {
+      public:
+        // A size of 0 is derived from the first frame's aspect ratio (and the other size).
+        TerminalDisplay(int columns = 0, int rows = 0, std::ostream &out = std::cout);
+        ~TerminalDisplay();
+
+        // Shows a width x height image with rows top-down, pitch pixels apart,
+        // scaled to the terminal size with a box filter. The shifts give the
+        // position of the red, green and blue bytes in a pixel.
+        void present(const uint32_t *pixels, int width, int height, int pitch, int r_shift, int g_shift,
+                     int b_shift);
+
+        // Cells whose channels all moved by at most this much since they were
+        // drawn are left alone. 0 (the default) redraws every change.
+        void setTolerance(int tolerance);
+
+        // Redraws everything on the next frame, e.g. after something else wrote to the terminal.
+        void invalidate();
+
+        // Restores the cursor and colors and moves below the image. Called by the destructor.
+        void end();
+
+        int columns() const;
+        int rows() const;
+        const TerminalStats &stats() const;
+
+      private:
+        struct Cell
+        {
+            uint32_t top, bottom; // 0xRRGGBB
+        };
+
+        void resize(int width, int height);
+        bool changed(const Cell &now, const Cell &shown) const;
+        int cellCost(const Cell &cell) const;
+        void moveTo(int row, int col);
+        void drawCell(const Cell &cell);
+        void setColors(int64_t fg, int64_t bg);
+
+        std::ostream &out;
+        int cols, rows_, tolerance = 0;
+        bool started = false, valid = false;
+        std::vector<Cell> shown, next;
+        std::string buf;
+        int cur_row = -1, cur_col = -1; // -1 when unknown
+        int64_t cur_fg = -1, cur_bg = -1;
+        TerminalStats stats_;
+    };
+
+} // namespace Core
+} // namespace COL781
+
+#endif
@@ -0,0 +1,129 @@
+#include "tiling.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace COL781
+{
+namespace Core
+{
+
+    const int min_units = 8, max_units = 64;
+    const int l1_bytes = 32 * 1024;
+    const int bytes_per_pixel = 8; // color and depth
+    const int tiles_per_thread = 4;
+    const int patience = 4; // batches a new size has to be suggested in a row before switching
+
+    TileTuner::TileTuner(int fb_width, int fb_height, int unit, int n_threads)
+        : width(fb_width), height(fb_height), unit(unit), n_threads(n_threads)
+    {
+        stats_.tile_size = 16 * unit;
+    }
+
+    std::vector<int> TileTuner::candidates() const
+    {
+        std::vector<int> sizes;
+        for (int s = min_units; s <= max_units; s *= 2)
+        {
+            sizes.push_back(s * unit);
+        }
+        return sizes;
+    }
+
+    // Estimated work for the mean triangle with tiles of the given size, in pixel visits.
+    // Tile loops sweep whole tiles, so besides its own pixels a triangle pays for all of
+    // every tile its edges cross (about perimeter / size of them, plus one), and a fixed
+    // overhead for each tile it is binned into.
+    double TileTuner::cost(int size) const
+    {
+        const double per_tile = 64;
+        double a = stats_.mean_area, p = stats_.mean_perimeter, s = size;
+        double partial = p / s + 1;
+        return a + partial * s * s + per_tile * (a / (s * s) + partial);
+    }
+
+    int TileTuner::suggested() const
+    {
+        auto n_tiles = [&](int s) { return ((width + s - 1) / s) * ((height + s - 1) / s); };
+        int best = min_units * unit;
+        for (int s : candidates())
+        {
+            if (s > best && (n_tiles(s) < tiles_per_thread * n_threads || s * s * bytes_per_pixel > l1_bytes))
+                break;
+            if (cost(s) < cost(best))
+                best = s;
+        }
+        return best;
+    }
+
+    bool TileTuner::endBatch()
+    {
+        if (batch_tris == 0)
+            return false;
+        // running means, weighting recent batches more
+        double w = stats_.triangles == 0 ? 1.0 : 0.25;
+        stats_.mean_area = (1 - w) * stats_.mean_area + w * batch_area / batch_tris;
+        stats_.mean_perimeter = (1 - w) * stats_.mean_perimeter + w * batch_perimeter / batch_tris;
+        stats_.triangles += batch_tris;
+        batch_area = batch_perimeter = 0;
+        batch_tris = 0;
+        if (!stats_.adaptive)
+            return false;
+
+        int s = suggested();
+        if (s == stats_.tile_size)
+        {
+            streak = 0;
+            return false;
+        }
+        streak = s == pending ? streak + 1 : 1;
+        pending = s;
+        if (streak < patience)
+            return false;
+        stats_.tile_size = s;
+        stats_.retunes++;
+        streak = 0;
+        return true;
+    }
+
+    void TileTuner::setFixed(int size)
+    {
+        stats_.tile_size = size;
+        stats_.adaptive = false;
+    }
+
+    void TileTuner::calibrate(const std::function<void(int)> &render, int reps)
+    {
+        using namespace std::chrono;
+
+        double best = INFINITY;
+        int best_size = stats_.tile_size;
+        stats_.adaptive = false;
+        for (int s : candidates())
+        {
+            stats_.tile_size = s;
+            std::vector<double> times;
+            for (int i = 0; i < reps; i++)
+            {
+                auto tic = steady_clock::now();
+                render(s);
+                times.push_back(duration<double>(steady_clock::now() - tic).count());
+            }
+            std::sort(times.begin(), times.end());
+            if (times[times.size() / 2] < best)
+            {
+                best = times[times.size() / 2];
+                best_size = s;
+            }
+        }
+        stats_.tile_size = best_size;
+        stats_.calibrated = true;
+    }
+
+    const TilingStats &TileTuner::stats() const
+    {
+        return stats_;
+    }
+
+} // namespace Core
+} // namespace COL781
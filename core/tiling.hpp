@@ -0,0 +1,97 @@
+#ifndef CORE_TILING_HPP
+#define CORE_TILING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+namespace COL781
+{
+namespace Core
+{
+
+    struct TilingStats
+    {
+        int tile_size = 16;        // in framebuffer pixels
+        bool adaptive = true;      // following the sizes of the triangles being drawn
+        bool calibrated = false;   // picked by a calibration run
+        int retunes = 0;           // times the adaptive tuner changed the size
+        double mean_area = 0;      // running mean of on-screen triangle area, in pixels
+        double mean_perimeter = 0; // and perimeter
+        long triangles = 0;        // triangles binned
+        long tile_refs = 0;        // (triangle, tile) pairs binned
+    };
+
+    /* Picks the tile size of a tiled rasterizer. Sizes are powers of two times
+       `unit` (the supersampling factor, so that tiles cover whole output pixels).
+
+       The size is either fixed with setFixed, measured once with calibrate, or
+       adaptive (the default): the binning loop reports each triangle through
+       observe, and endBatch moves towards the size with the lowest estimated
+       cost for the running mean triangle, keeping enough tiles for all threads
+       and a tile's color and depth within L1. */
+    class TileTuner
+    {
+      public:
+        TileTuner(int fb_width = 0, int fb_height = 0, int unit = 1, int n_threads = 4);
+
+        int tileSize() const
+        {
+            return stats_.tile_size;
+        }
+
+        // Called by the binning loop for every triangle, with its area and perimeter
+        // and its bounding box clipped to the screen, all in pixels.
+        void observe(float area, float perimeter, int bbox_w, int bbox_h, int n_tiles)
+        {
+            bbox_w = std::max(bbox_w, 0);
+            bbox_h = std::max(bbox_h, 0);
+            batch_area += std::min(area, float(bbox_w) * bbox_h);
+            batch_perimeter += std::min(perimeter, 2.0f * (bbox_w + bbox_h));
+            batch_tris++;
+            stats_.tile_refs += n_tiles;
+        }
+
+        // Same, for a triangle given by its vertices in NDC (anything with .x and .y).
+        template <typename Vec> void observeNdc(const Vec (&tri)[3], int bbox_w, int bbox_h, int n_tiles)
+        {
+            float sx = width / 2.0f, sy = height / 2.0f;
+            float area = 0.5f * sx * sy *
+                         fabsf((tri[1].x - tri[0].x) * (tri[2].y - tri[0].y) - (tri[2].x - tri[0].x) * (tri[1].y - tri[0].y));
+            float perimeter = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                perimeter += hypotf((tri[(k + 1) % 3].x - tri[k].x) * sx, (tri[(k + 1) % 3].y - tri[k].y) * sy);
+            }
+            observe(area, perimeter, bbox_w, bbox_h, n_tiles);
+        }
+
+        // Called after every batch. Returns true if the tile size changed, in which
+        // case the caller must rebuild anything laid out on the tile grid.
+        bool endBatch();
+
+        void setFixed(int size);
+
+        // Calls render(tile size) reps times for every candidate size and keeps the fastest.
+        // tileSize() returns the candidate being measured while render runs.
+        void calibrate(const std::function<void(int)> &render, int reps = 3);
+
+        std::vector<int> candidates() const;
+        const TilingStats &stats() const;
+
+      private:
+        int suggested() const;
+        double cost(int size) const;
+
+        int width, height, unit, n_threads;
+        TilingStats stats_;
+        double batch_area = 0, batch_perimeter = 0;
+        long batch_tris = 0;
+        int pending = 0, streak = 0;
+    };
+
+} // namespace Core
+} // namespace COL781
+
+#endif
@@ -0,0 +1,265 @@
+#include "rasterizer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+/* Microbenchmark for the tiled rasterizer.
+   Sweeps triangle distributions, tile sizes, thread counts and resolutions, and
+   reports median/p95 throughput and per-thread utilization as CSV or JSON.
+   A tile size of "auto" lets the rasterizer adapt it during warmup, "cal" calibrates
+   it on the benchmark batch; the size that ends up used is reported.
+
+   usage: bench [--dist uniform,tiny,medium,fullscreen,sliver] [--tiles 8,16,32,auto,cal]
+                [--threads 1,2,4] [--res 640x480,1920x1080] [--tris 10000]
+                [--warmup 2] [--reps 10] [--format csv|json] [--out file] [--seed 1]
+*/
+
+const int tile_auto = 0, tile_calibrate = -1;
+
+struct Config {
+    std::vector<std::string> dists = {"uniform", "tiny", "medium", "fullscreen", "sliver"};
+    std::vector<int> tiles = {8, 16, 32, tile_auto};
+    std::vector<int> threads = {1, 2, 4};
+    std::vector<glm::ivec2> resolutions = {glm::ivec2(640, 480)};
+    int n_tris = 10000;
+    int warmup = 2;
+    int reps = 10;
+    std::string format = "csv";
+    std::string out;
+    unsigned seed = 1;
+};
+
+struct Result {
+    std::string dist;
+    glm::ivec2 res;
+    std::string tile_mode;
+    int tile, threads, n_tris, reps;
+    double median_ms, p95_ms;
+    std::vector<double> utilization; // per thread, busy time / wall time
+};
+
+std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> parts;
+    std::stringstream ss(s);
+    std::string part;
+    while (std::getline(ss, part, sep)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+bool parse_args(int argc, char** argv, Config& cfg) {
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if (i+1 >= argc) {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string val = argv[++i];
+        if (arg == "--dist") {
+            cfg.dists = split(val, ',');
+        } else if (arg == "--tiles") {
+            cfg.tiles.clear();
+            for (auto& t : split(val, ',')) {
+                cfg.tiles.push_back(t == "auto" ? tile_auto : t == "cal" ? tile_calibrate : std::stoi(t));
+            }
+        } else if (arg == "--threads") {
+            cfg.threads.clear();
+            for (auto& t : split(val, ',')) cfg.threads.push_back(std::stoi(t));
+        } else if (arg == "--res") {
+            cfg.resolutions.clear();
+            for (auto& r : split(val, ',')) {
+                auto wh = split(r, 'x');
+                if (wh.size() != 2) {
+                    std::cerr << "bad resolution " << r << ", expected WxH" << std::endl;
+                    return false;
+                }
+                cfg.resolutions.push_back(glm::ivec2(std::stoi(wh[0]), std::stoi(wh[1])));
+            }
+        } else if (arg == "--tris") {
+            cfg.n_tris = std::stoi(val);
+        } else if (arg == "--warmup") {
+            cfg.warmup = std::stoi(val);
+        } else if (arg == "--reps") {
+            cfg.reps = std::max(1, std::stoi(val));
+        } else if (arg == "--format") {
+            cfg.format = val;
+        } else if (arg == "--out") {
+            cfg.out = val;
+        } else if (arg == "--seed") {
+            cfg.seed = std::stoul(val);
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Random triangles in NDC, sized in pixels of a w x h framebuffer.
+bool make_triangles(const std::string& dist, int w, int h, int n, unsigned seed, std::vector<Triangle>& tris) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u(-1, 1), angle(0, 2*M_PI);
+    glm::vec2 px(2.0f/w, 2.0f/h); // one pixel in NDC
+
+    // a triangle around c, with vertices at the given pixel distances and random angles
+    auto around = [&](glm::vec2 c, float r_min, float r_max) {
+        std::uniform_real_distribution<float> r(r_min, r_max);
+        Triangle t;
+        for (int k=0; k<3; k++) {
+            float a = angle(rng), d = r(rng);
+            t.v[k] = c + glm::vec2(cosf(a), sinf(a))*d*px;
+        }
+        return t;
+    };
+
+    tris.resize(n);
+    for (int i=0; i<n; i++) {
+        glm::vec2 c(u(rng), u(rng));
+        if (dist == "uniform") {
+            tris[i] = {{glm::vec2(u(rng), u(rng)), glm::vec2(u(rng), u(rng)), glm::vec2(u(rng), u(rng))}};
+        } else if (dist == "tiny") {
+            tris[i] = around(c, 0.5f, 2.0f);
+        } else if (dist == "medium") {
+            tris[i] = around(c, 8.0f, 32.0f);
+        } else if (dist == "fullscreen") {
+            // vertices spread 120 degrees apart, far enough out to cover the screen
+            float a = angle(rng), d = 2.0f*std::max(w, h);
+            for (int k=0; k<3; k++) {
+                float ak = a + k*2*M_PI/3;
+                tris[i].v[k] = 0.2f*c + glm::vec2(cosf(ak), sinf(ak))*d*px;
+            }
+        } else if (dist == "sliver") {
+            // long and about a pixel wide
+            float a = angle(rng), len = 100 + 300*(u(rng) + 1)/2;
+            glm::vec2 dir(cosf(a), sinf(a)), nrm(-dir.y, dir.x);
+            tris[i] = {{c, c + dir*len*px, c + (dir*len*0.5f + nrm)*px}};
+        } else {
+            std::cerr << "unknown distribution " << dist << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+Result run(const Config& cfg, const std::string& dist, glm::ivec2 res, int tile, int n_threads,
+           const std::vector<Triangle>& tris, const std::vector<Uint32>& colors) {
+    using namespace std::chrono;
+
+    Rasterizer r(res.x, res.y, n_threads);
+    r.rtp->start();
+    if (tile == tile_calibrate) {
+        r.calibrate_tile_size(tris.data(), colors.data(), tris.size());
+    } else if (tile != tile_auto) {
+        r.set_tile_size(tile);
+    }
+
+    for (int i=0; i<cfg.warmup; i++) {
+        r.clear(0);
+        r.rasterize(tris.data(), colors.data(), tris.size());
+    }
+    r.rtp->resetBusyTime();
+
+    std::vector<double> times;
+    double wall = 0;
+    for (int i=0; i<cfg.reps; i++) {
+        r.clear(0);
+        auto tic = steady_clock::now();
+        r.rasterize(tris.data(), colors.data(), tris.size());
+        double t = duration<double>(steady_clock::now() - tic).count();
+        times.push_back(t*1000);
+        wall += t;
+    }
+    r.rtp->stop();
+
+    const char* mode = tile == tile_calibrate ? "calibrated" : tile == tile_auto ? "auto" : "fixed";
+    Result result{dist, res, mode, r.tiling_stats().tile_size, n_threads, (int)tris.size(), cfg.reps};
+    std::sort(times.begin(), times.end());
+    result.median_ms = times[times.size()/2];
+    result.p95_ms = times[std::min(times.size()-1, (size_t)ceil(0.95*times.size()) - 1)];
+    // the workers, then the calling thread
+    for (int i=0; i<=r.rtp->size(); i++) {
+        result.utilization.push_back(r.rtp->busyTime(i)/wall);
+    }
+    return result;
+}
+
+void write_csv(std::ostream& out, const std::vector<Result>& results) {
+    out << "dist,width,height,tile_mode,tile,threads,tris,reps,median_ms,p95_ms,median_tris_per_s,p95_tris_per_s,"
+           "mean_utilization,utilization" << std::endl;
+    for (auto& r : results) {
+        double mean = 0;
+        std::string per_thread;
+        for (double u : r.utilization) {
+            mean += u/r.utilization.size();
+            per_thread += (per_thread.empty() ? "" : ";") + std::to_string(u);
+        }
+        out << r.dist << "," << r.res.x << "," << r.res.y << "," << r.tile_mode << "," << r.tile << "," << r.threads << "," << r.n_tris
+            << "," << r.reps << "," << r.median_ms << "," << r.p95_ms << "," << 1000*r.n_tris/r.median_ms << ","
+            << 1000*r.n_tris/r.p95_ms << "," << mean << "," << per_thread << std::endl;
+    }
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results) {
+    out << "[" << std::endl;
+    for (int i=0; i<results.size(); i++) {
+        auto& r = results[i];
+        out << "  {\"dist\": \"" << r.dist << "\", \"width\": " << r.res.x << ", \"height\": " << r.res.y
+            << ", \"tile_mode\": \"" << r.tile_mode << "\", \"tile\": " << r.tile << ", \"threads\": " << r.threads << ", \"tris\": " << r.n_tris
+            << ", \"reps\": " << r.reps << ", \"median_ms\": " << r.median_ms << ", \"p95_ms\": " << r.p95_ms
+            << ", \"median_tris_per_s\": " << 1000*r.n_tris/r.median_ms
+            << ", \"p95_tris_per_s\": " << 1000*r.n_tris/r.p95_ms << ", \"utilization\": [";
+        for (int t=0; t<r.utilization.size(); t++) {
+            out << (t ? ", " : "") << r.utilization[t];
+        }
+        out << "]}" << (i+1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+
+    Config cfg;
+    if (!parse_args(argc, argv, cfg)) return 1;
+    if (cfg.format != "csv" && cfg.format != "json") {
+        std::cerr << "unknown format " << cfg.format << ", expected csv or json" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (auto res : cfg.resolutions) {
+        for (auto& dist : cfg.dists) {
+            std::vector<Triangle> tris;
+            if (!make_triangles(dist, res.x, res.y, cfg.n_tris, cfg.seed, tris)) return 1;
+            std::mt19937 rng(cfg.seed);
+            std::vector<Uint32> colors(tris.size());
+            for (auto& c : colors) c = rng() | 0xFF;
+
+            for (int tile : cfg.tiles) {
+                for (int n_threads : cfg.threads) {
+                    results.push_back(run(cfg, dist, res, tile, n_threads, tris, colors));
+                    auto& r = results.back();
+                    std::cerr << dist << " " << res.x << "x" << res.y << " tile " << r.tile << " (" << r.tile_mode
+                              << ") threads " << n_threads
+                              << ": " << r.median_ms << " ms" << std::endl;
+                }
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!cfg.out.empty()) file.open(cfg.out);
+    std::ostream& out = cfg.out.empty() ? std::cout : file;
+    if (cfg.format == "csv") {
+        write_csv(out, results);
+    } else {
+        write_json(out, results);
+    }
+    return 0;
+}
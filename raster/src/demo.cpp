@@ -0,0 +1,116 @@
+#include "rasterizer.hpp"
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+
+// tests
+
+static std::random_device rd;
+static std::mt19937 rng{rd()}; 
+
+void benchmark(Rasterizer& r, int n_tris) {
+
+    using namespace std::chrono;
+
+    static std::uniform_real_distribution<double> dist(-1,1);
+    static std::uniform_int_distribution<uint32_t> cdist(0x0100, 0xFFFFFF00);
+    std::vector<Triangle> tris(n_tris);
+    std::vector<Uint32> colors(n_tris);
+    for (int i=0; i<n_tris; i++) {
+        for (int k=0; k<3; k++) {
+            tris[i].v[k] = glm::vec2(dist(rng), dist(rng));
+        }
+        colors[i] = cdist(rng);
+    }
+    r.rtp->start();
+
+    auto tic = high_resolution_clock::now();
+    for (int i=0; i<n_tris; i++) {
+        r.rasterize(tris[i].v, colors[i]);
+    }
+    auto toc = high_resolution_clock::now();
+    auto duration = duration_cast<microseconds>(toc - tic).count();
+    std::cout << "Render " << n_tris << " tris one at a time in " << duration << " us (" 
+              << (1000000.f*n_tris/duration) << " tris/sec)" << std::endl;
+
+    tic = high_resolution_clock::now();
+    r.rasterize(tris.data(), colors.data(), n_tris);
+    toc = high_resolution_clock::now();
+    duration = duration_cast<microseconds>(toc - tic).count();
+    std::cout << "Render " << n_tris << " tris as a batch in " << duration << " us (" 
+              << (1000000.f*n_tris/duration) << " tris/sec)" << std::endl;
+    r.rtp->stop();
+}
+
+// Spins a batch of triangles, streaming the frames to the terminal (e.g. over ssh).
+void terminal_demo(Rasterizer& r, int n_tris, int frames) {
+
+    static std::uniform_real_distribution<float> dist(-1,1);
+    static std::uniform_int_distribution<uint32_t> cdist(0x0100, 0xFFFFFF00);
+    std::vector<Triangle> tris(n_tris), spun(n_tris);
+    std::vector<Uint32> colors(n_tris);
+    for (int i=0; i<n_tris; i++) {
+        glm::vec2 c(dist(rng), dist(rng));
+        for (int k=0; k<3; k++) {
+            tris[i].v[k] = c + 0.2f*glm::vec2(dist(rng), dist(rng));
+        }
+        colors[i] = cdist(rng) | 0xFF;
+    }
+
+    COL781::Core::TerminalDisplay terminal;
+    r.rtp->start();
+    for (int f=0; f<frames; f++) {
+        float c = cosf(0.02f*f), s = sinf(0.02f*f);
+        for (int i=0; i<n_tris; i++) {
+            for (int k=0; k<3; k++) {
+                glm::vec2 v = tris[i].v[k];
+                spun[i].v[k] = glm::vec2(c*v.x - s*v.y, s*v.x + c*v.y);
+            }
+        }
+        r.clear(0x222222FF);
+        r.rasterize(spun.data(), colors.data(), n_tris);
+        r.display(terminal);
+        std::this_thread::sleep_for(std::chrono::milliseconds(33));
+    }
+    r.rtp->stop();
+    terminal.end();
+    std::cout << terminal.stats().bytes/frames << " bytes per frame" << std::endl;
+}
+
+void thread_pool_test() {
+    RasterizerThreadPool r(4);
+
+    std::mutex out;
+    r.parallelFor(8, [&](int tid, int job) {
+        std::lock_guard<std::mutex> lock(out);
+        std::cout << "job " << job << " on thread " << tid << "\n";
+    });
+    r.stop();
+}
+
+int main(int argc, char** argv) {
+
+    Rasterizer r(640, 480);
+    if (argc > 1 && std::string(argv[1]) == "--terminal") {
+        terminal_demo(r, 200, argc > 2 ? std::stoi(argv[2]) : 300);
+        return 0;
+    }
+    r.clear(0x22222200);
+    /*
+    glm::vec2 tri[3] = {
+        glm::vec2(-0.3, 0.6),
+        glm::vec2(-0.8, 0.4),
+        glm::vec2(0.5, -0.4)
+    };
+    r.rasterize(tri, 0xFF000000);
+    */
+    benchmark(r, 1000);
+
+    r.display();
+    
+    // thread_pool_test();
+
+    return 0;
+}
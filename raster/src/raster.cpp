@@ -14,6 +14,8 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <glm/glm.hpp>
+#include "../../core/blend.hpp"
+#include "../../core/coverage.hpp"
 
 /* Framebuffer-related variables.
      We create a 10x10 image and display it at 40x size so you can clearly
@@ -25,6 +27,10 @@ const int frameHeight = 80;
 
 const int displayScale = 5;
 
+/* Anti-aliasing samples per pixel: 1, 2, 4, 8 or 16 (rotated grid). */
+
+const int msaaSamples = 4;
+
 SDL_Surface *framebuffer = NULL;
 
 /* SDL parameters */
@@ -67,23 +73,6 @@ glm::vec2 pix_to_pt(int x, int y)
     return glm::vec2((float(x) + 0.5) / frameWidth, (float(y) + 0.5) / frameHeight);
 }
 
-Uint32 pix_blend(Uint32 new_pix, Uint32 old_pix)
-{
-    SDL_PixelFormat *format = framebuffer->format;
-    Uint8 r_new, g_new, b_new, a_new;
-    SDL_GetRGBA(new_pix, format, &r_new, &g_new, &b_new, &a_new);
-    Uint8 r_old, g_old, b_old, a_old;
-    SDL_GetRGBA(old_pix, format, &r_old, &g_old, &b_old, &a_old);
-    Uint32 color;
-    float alpha_new = a_new / (float)255, alpha_old = a_old / (float)255;
-    r_new = r_new * alpha_new + r_old * (1 - alpha_new);
-    g_new = g_new * alpha_new + g_old * (1 - alpha_new);
-    b_new = b_new * alpha_new + b_old * (1 - alpha_new);
-    a_new = 255 * (alpha_new + alpha_old * (1 - alpha_new));
-    color = SDL_MapRGBA(format, r_new, g_new, b_new, a_new);
-    return color;
-}
-
 int value_binary(glm::vec2 (&triangle)[3], int x, int y)
 {
     glm::vec2 pt = pix_to_pt(x, y);
@@ -93,25 +82,10 @@ int value_binary(glm::vec2 (&triangle)[3], int x, int y)
         return -1;
 }
 
-float value_4xmsaa_rot(glm::vec2 (&triangle)[3], int x, int y)
+float value_msaa(const COL781::Core::TriangleCoverage &coverage, int x, int y)
 {
-    glm::vec2 pt1 = pix_to_pt(x, y) + glm::vec2(0.3 / frameWidth, 0.2 / frameHeight);
-    glm::vec2 pt2 = pix_to_pt(x, y) + glm::vec2(-0.2 / frameWidth, 0.3 / frameHeight);
-    glm::vec2 pt3 = pix_to_pt(x, y) + glm::vec2(-0.3 / frameWidth, -0.2 / frameHeight);
-    glm::vec2 pt4 = pix_to_pt(x, y) + glm::vec2(0.2 / frameWidth, -0.3 / frameHeight);
-
-    float alpha = 0;
-
-    if (membership_check(triangle, pt1))
-        alpha += 0.25;
-    if (membership_check(triangle, pt2))
-        alpha += 0.25;
-    if (membership_check(triangle, pt3))
-        alpha += 0.25;
-    if (membership_check(triangle, pt4))
-        alpha += 0.25;
-
-    return alpha;
+    glm::vec2 pt = pix_to_pt(x, y);
+    return coverage.at(pt.x, pt.y).fraction;
 }
 
 void render_background()
@@ -135,17 +109,20 @@ void render_naive(glm::vec2 (&triangle)[3])
 
     Uint32 *pixels = (Uint32 *)framebuffer->pixels;
     SDL_PixelFormat *format = framebuffer->format;
+    COL781::Core::TriangleCoverage coverage(triangle, COL781::Core::SamplePattern::rotated(msaaSamples),
+                                            1.0f / frameWidth, 1.0f / frameHeight);
+    Uint32 color = COL781::Core::premultiply(SDL_MapRGBA(format, 0, 153, 0, 255), format->Ashift);
+    Uint8 alpha[frameWidth];
 
     for (int i = 0; i < frameHeight; i++)
     {
         for (int j = 0; j < frameWidth; j++)
         {
-            Uint32 background = pixels[(frameHeight - i - 1) * frameWidth + j];
-            Uint32 foreground;
-            float v = value_4xmsaa_rot(triangle, j, i);
-            foreground = SDL_MapRGBA(format, 0, 153, 0, 255 * v);
-            pixels[(frameHeight - i - 1) * frameWidth + j] = pix_blend(foreground, background);
+            alpha[j] = 255 * value_msaa(coverage, j, i);
         }
+        // the color is drawn with its coverage as alpha over what is already there
+        COL781::Core::blendMasked(COL781::Core::BlendMode::SourceOver, color, alpha,
+                                  pixels + (frameHeight - i - 1) * frameWidth, frameWidth, format->Ashift);
     }
 }
 
@@ -1,56 +1,47 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <functional>
-#include <mutex>
 #include <SDL2/SDL.h>
+#include <vector>
+#include "../../core/raster.hpp"
+#include "../../core/terminal.hpp"
 
-class Rasterizer;
-
-class RasterizerThreadPool {
-    public:
-        RasterizerThreadPool(Rasterizer* r, size_t n_threads);
-        ~RasterizerThreadPool();
-        void run();
-        void start();
-        void stop();
-        void enqueue(glm::ivec2 tl, glm::ivec2 br);
-        void set_render_function(std::function<void(int,Rasterizer*,glm::vec2(&)[3],glm::ivec2&,glm::ivec2&)> fn);
-        void set_triangle(glm::vec2 (&tri)[3]);
-
-    private:
-        void _thread_fn(int thread_idx);
-
-        Rasterizer *_r;
-        size_t _n_threads;
-        std::vector<std::thread> _threads;
-        std::vector<std::vector<std::pair<glm::ivec2,glm::ivec2>>> _workqueues;
-        int _next_workq;
-        volatile bool _alive;
-        std::vector<bool> _work;
-        std::vector<bool> _relax;
-        std::vector<std::mutex> _work_lock;
-        std::vector<std::mutex> _work_write_lock;
-        glm::vec2 _tri[3];
-        std::function<void(int, Rasterizer*, glm::vec2(&)[3], glm::ivec2&, glm::ivec2&)> _fn;
+struct Triangle {
+    glm::vec2 v[3];
 };
 
+// Worker threads plus the calling thread, shared with a1 (see core/raster.hpp).
+using RasterizerThreadPool = COL781::Core::ThreadPool;
+
 class Rasterizer {
 
     public:
-    Rasterizer(int w, int h);
+    // n_threads counts the calling thread, which draws along with the workers.
+    Rasterizer(int w, int h, int n_threads = 4);
     ~Rasterizer();
     void rasterize(glm::vec2 (&tri)[3], Uint32 color);
+    // Bins the whole batch into tiles and rasterizes them in one parallel pass.
+    // Triangles are drawn in the order given wherever they overlap.
+    void rasterize(const Triangle *tris, const Uint32 *colors, size_t n);
     void clear(Uint32 color);
+    // Fixes the tile size. Otherwise it adapts to the triangles being drawn.
+    void set_tile_size(int size);
+    // Picks the tile size by timing the given batch at every candidate size.
+    void calibrate_tile_size(const Triangle *tris, const Uint32 *colors, size_t n);
+    const COL781::Core::TilingStats& tiling_stats() const;
     void* get_framebuffer();
     int width();
     int height();
 
     int display();
+    // Shows the framebuffer in the terminal instead, redrawing only what changed since the last call.
+    void display(COL781::Core::TerminalDisplay& terminal);
     Uint32* fb;
     RasterizerThreadPool *rtp;
 
     private:
     int _w, _h;
+    COL781::Core::TileBinner _binner;
+    std::vector<COL781::Core::TriangleSetup> _setups; // of the batch being drawn
 };
 
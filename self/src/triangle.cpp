@@ -1,10 +1,16 @@
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <glm/glm.hpp>
+#include "../../core/coverage.hpp"
+#include "../../core/terminal.hpp"
 
 using namespace std;
 
 const int WIDTH = 120;
 const int HEIGHT = 40;
+const int SAMPLES = 4; // per pixel, 1, 2, 4, 8 or 16
 // const float YX_RATIO = 2;
 
 const uint8_t DARK_4 = 250;
@@ -36,46 +42,11 @@ glm::vec2 pix_to_pt(int x, int y)
     return glm::vec2((float(x) + 0.5) / WIDTH, (float(y) + 0.5) / HEIGHT);
 }
 
-int value_4xmsaa_square(glm::vec2 (&triangle)[3], int x, int y)
+// Shade from the fraction of covered samples, rounded to the five levels print knows.
+int value_msaa(const COL781::Core::TriangleCoverage &coverage, int x, int y)
 {
-    glm::vec2 pt1 = pix_to_pt(x, y) + glm::vec2(0.25 / WIDTH, 0.25 / HEIGHT);
-    glm::vec2 pt2 = pix_to_pt(x, y) + glm::vec2(-0.25 / WIDTH, 0.25 / HEIGHT);
-    glm::vec2 pt3 = pix_to_pt(x, y) + glm::vec2(0.25 / WIDTH, -0.25 / HEIGHT);
-    glm::vec2 pt4 = pix_to_pt(x, y) + glm::vec2(-0.25 / WIDTH, -0.25 / HEIGHT);
-
-    uint8_t color = DARK_0;
-
-    if (membership_check(triangle, pt1))
-        color += 50;
-    if (membership_check(triangle, pt2))
-        color += 50;
-    if (membership_check(triangle, pt3))
-        color += 50;
-    if (membership_check(triangle, pt4))
-        color += 50;
-
-    return color;
-}
-
-int value_4xmsaa_rot(glm::vec2 (&triangle)[3], int x, int y)
-{
-    glm::vec2 pt1 = pix_to_pt(x, y) + glm::vec2(0.3 / WIDTH, 0.2 / HEIGHT);
-    glm::vec2 pt2 = pix_to_pt(x, y) + glm::vec2(-0.2 / WIDTH, 0.3 / HEIGHT);
-    glm::vec2 pt3 = pix_to_pt(x, y) + glm::vec2(-0.3 / WIDTH, -0.2 / HEIGHT);
-    glm::vec2 pt4 = pix_to_pt(x, y) + glm::vec2(0.2 / WIDTH, -0.3 / HEIGHT);
-
-    uint8_t color = DARK_0;
-
-    if (membership_check(triangle, pt1))
-        color += 50;
-    if (membership_check(triangle, pt2))
-        color += 50;
-    if (membership_check(triangle, pt3))
-        color += 50;
-    if (membership_check(triangle, pt4))
-        color += 50;
-
-    return color;
+    glm::vec2 pt = pix_to_pt(x, y);
+    return DARK_0 + 50 * int(coverage.at(pt.x, pt.y).fraction * 4 + 0.5f);
 }
 
 int value_binary(glm::vec2 (&triangle)[3], int x, int y)
@@ -89,18 +60,22 @@ int value_binary(glm::vec2 (&triangle)[3], int x, int y)
 
 void render_naive(glm::vec2 (&triangle)[3], uint8_t (&display)[HEIGHT][WIDTH])
 {
+    COL781::Core::TriangleCoverage coverage(triangle, COL781::Core::SamplePattern::rotated(SAMPLES), 1.0f / WIDTH,
+                                            1.0f / HEIGHT);
 
     for (int i = 0; i < HEIGHT; i++)
     {
         for (int j = 0; j < WIDTH; j++)
         {
-            display[HEIGHT - i - 1][j] = value_4xmsaa_rot(triangle, j, i);
+            display[HEIGHT - i - 1][j] = value_msaa(coverage, j, i);
         }
     }
 }
 
 void render_bbox(glm::vec2 (&triangle)[3], uint8_t (&display)[HEIGHT][WIDTH])
 {
+    COL781::Core::TriangleCoverage coverage(triangle, COL781::Core::SamplePattern::rotated(SAMPLES), 1.0f / WIDTH,
+                                            1.0f / HEIGHT);
     int min_x = floor(min(triangle[0].x, min(triangle[1].x, triangle[2].x)) * WIDTH);
     int max_x = ceil(max(triangle[0].x, max(triangle[1].x, triangle[2].x)) * WIDTH);
     int min_y = floor(min(triangle[0].y, min(triangle[1].y, triangle[2].y)) * HEIGHT);
@@ -109,7 +84,7 @@ void render_bbox(glm::vec2 (&triangle)[3], uint8_t (&display)[HEIGHT][WIDTH])
     {
         for (int j = min_x; j < max_x; j++)
         {
-            display[HEIGHT - i - 1][j] = value_4xmsaa_rot(triangle, j, i);
+            display[HEIGHT - i - 1][j] = value_msaa(coverage, j, i);
         }
     }
 }
@@ -148,8 +123,54 @@ void print(uint8_t (&display)[HEIGHT][WIDTH])
     }
 }
 
+// Spins the triangle about its centroid, streaming the frames to the terminal
+// as colored half blocks (WIDTH x HEIGHT pixels in WIDTH x HEIGHT/2 cells).
+void animate(glm::vec2 (&triangle)[3], int frames)
+{
+    COL781::Core::TerminalDisplay terminal(WIDTH, HEIGHT / 2);
+    uint8_t display[HEIGHT][WIDTH];
+    uint32_t pixels[HEIGHT][WIDTH];
+
+    // rotate in pixels, so that the triangle keeps its shape
+    glm::vec2 scale(WIDTH, HEIGHT);
+    glm::vec2 center = (triangle[0] + triangle[1] + triangle[2]) * scale / 3.0f;
+    for (int f = 0; f < frames; f++)
+    {
+        float c = cos(0.05f * f), s = sin(0.05f * f);
+        glm::vec2 spun[3];
+        for (int k = 0; k < 3; k++)
+        {
+            glm::vec2 d = triangle[k] * scale - center;
+            spun[k] = (center + glm::vec2(c * d.x - s * d.y, s * d.x + c * d.y)) / scale;
+        }
+        render_naive(spun, display);
+
+        // shading levels from the background grey to green
+        for (int i = 0; i < HEIGHT; i++)
+        {
+            for (int j = 0; j < WIDTH; j++)
+            {
+                uint32_t t = display[i][j] - DARK_0, u = DARK_4 - DARK_0 - t;
+                uint32_t r = (0x20 * u) / 200, g = (0x20 * u + 0x99 * t) / 200, b = (0x20 * u) / 200;
+                pixels[i][j] = r << 16 | g << 8 | b;
+            }
+        }
+        terminal.present(&pixels[0][0], WIDTH, HEIGHT, WIDTH, 16, 8, 0);
+        this_thread::sleep_for(chrono::milliseconds(33));
+    }
+    terminal.end();
+    cout << terminal.stats().bytes / frames << " bytes per frame" << endl;
+}
+
 int main(int argc, char **argv)
 {
+    // triangle --animate [frames]
+    if (argc > 1 && string(argv[1]) == "--animate")
+    {
+        glm::vec2 triangle[3] = {glm::vec2(0.3, 0.2), glm::vec2(0.6, 0.3), glm::vec2(0.5, 0.8)};
+        animate(triangle, argc > 2 ? atoi(argv[2]) : 200);
+        return 0;
+    }
 
     // triangle in NDC, anticlock vertices
     glm::vec2 triangle[3] = {glm::vec2(0.3, 0.2), glm::vec2(0.6, 0.3), glm::vec2(0.5, 0.8)};